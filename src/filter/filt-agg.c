@@ -0,0 +1,431 @@
+/**
+ * @file filt-agg.c
+ * @author Key Liao
+ *
+ * Aggregating per-rank csv files of a measurement run to the inputs of filt.x,
+ * builds filt-agg.x. Each directory is scanned once with parallel readers:
+ *   met dir -> met.csv, nsamp.out (quantile / nspv), binw.out
+ *   tf dir  -> tf.csv (time - nsamp * nspv)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "argp.h"
+#include "filt.h"
+
+typedef struct Agg_Param_T {
+    char *met_dir;
+    char *tf_dir;
+    char *out_dir;
+    int met_col;            // Time column of met files.
+    int nsamp_col;          // NSAMP column of tf files.
+    int tf_col;             // Time column of tf files.
+    double nspv;            // ns per vkern, 0 if not given.
+    double quant;           // Quantile of met for NSAMP.
+    int nthread;
+} agg_param_t;
+
+/*=== ARGP ===*/
+static struct argp_option options[] = {
+    {"met-dir", 'm', "DIR", 0, "Directory of per-rank measurement csvs, writes met.csv, nsamp.out and binw.out", 0},
+    {"met-col", 'c', "COL", 0, "Time column of measurement csvs (default 1)", 0},
+    {"tf-dir", 's', "DIR", 0, "Directory of per-rank timing fluctuation csvs, writes tf.csv", 0},
+    {"nsamp-col", 'S', "COL", 0, "NSAMP column of timing fluctuation csvs (default 1)", 0},
+    {"tf-col", 'T', "COL", 0, "Time column of timing fluctuation csvs (default 2)", 0},
+    {"nspv", 'v', "NS", 0, "Run time per vkern (ns), needed by nsamp.out and tf.csv", 0},
+    {"quantile", 'q', "PROB", 0, "Quantile of measured times giving NSAMP (default 0.5)", 0},
+    {"nthread", 't', "NUM", 0, "Number of reader threads", 0},
+    {"out-dir", 'o', "DIR", 0, "Directory of output files (default .)", 0},
+    {0}
+};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    agg_param_t *args = state->input;
+
+    switch (key) {
+        case 'm':
+            args->met_dir = arg;
+            break;
+        case 'c':
+            args->met_col = atoi(arg);
+            break;
+        case 's':
+            args->tf_dir = arg;
+            break;
+        case 'S':
+            args->nsamp_col = atoi(arg);
+            break;
+        case 'T':
+            args->tf_col = atoi(arg);
+            break;
+        case 'v':
+            args->nspv = atof(arg);
+            break;
+        case 'q':
+            args->quant = atof(arg);
+            break;
+        case 't':
+            args->nthread = atoi(arg);
+            break;
+        case 'o':
+            args->out_dir = arg;
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = {options, parse_opt, NULL, NULL};
+
+/*=== Reading directories ===*/
+
+typedef struct Agg_File_T {
+    char *path;
+    i64 *arr;
+    u64 len;
+    int err;
+} agg_file_t;
+
+typedef struct Agg_Task_T {
+    agg_file_t *files;
+    int col;                // Value column.
+    int scol;               // NSAMP column subtracted from col, -1 for none.
+    double nspv;
+} agg_task_t;
+
+static int
+cmp_name(const void *a, const void *b) {
+    return strcmp(((const agg_file_t *)a)->path, ((const agg_file_t *)b)->path);
+}
+
+// Reading the integer of column col in [p, eol), returns 0 if it is missing.
+static int
+read_col(const char *p, const char *eol, int col, i64 *v) {
+    char *q;
+
+    for (int c = 0; c < col; c ++) {
+        p = (const char *)memchr(p, ',', eol - p);
+        if (p == NULL) {
+            return 0;
+        }
+        p ++;
+    }
+    *v = strtoll(p, &q, 10);
+    return q != p && q <= eol;
+}
+
+static void
+agg_task(void *arg, int ithread, u64 i0, u64 i1) {
+    agg_task_t *at = (agg_task_t *)arg;
+
+    for (u64 i = i0; i < i1; i ++) {
+        agg_file_t *f = &at->files[i];
+        struct stat st;
+        char *buf;
+        const char *p, *end;
+        u64 nline = 1;
+        int fd = open(f->path, O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            printf("[FilT-agg] ERROR, cannot open %s.\n", f->path);
+            f->err = errno;
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        // The buffer ends with a NUL, so strtoll stops at the file end.
+        buf = (char *)malloc(st.st_size + 1);
+        if (buf == NULL || read(fd, buf, st.st_size) != st.st_size) {
+            printf("[FilT-agg] ERROR, reading %s failed.\n", f->path);
+            f->err = errno ? errno : EIO;
+            free(buf);
+            close(fd);
+            continue;
+        }
+        close(fd);
+        buf[st.st_size] = '\0';
+        end = buf + st.st_size;
+        for (p = buf; (p = (const char *)memchr(p, '\n', end - p)) != NULL; p ++) {
+            nline ++;
+        }
+        f->arr = (i64 *)malloc(nline * sizeof(i64));
+        if (f->arr == NULL) {
+            printf("[FilT-agg] ERROR, array allocation of %s failed.\n", f->path);
+            f->err = errno;
+            free(buf);
+            continue;
+        }
+        for (p = buf; p < end; ) {
+            const char *eol = (const char *)memchr(p, '\n', end - p);
+            i64 t, ns;
+            if (eol == NULL) {
+                eol = end;
+            }
+            if (read_col(p, eol, at->col, &t)) {
+                if (at->scol < 0) {
+                    f->arr[f->len ++] = t;
+                } else if (read_col(p, eol, at->scol, &ns)) {
+                    f->arr[f->len ++] = (i64)((double)t - (double)ns * at->nspv);
+                }
+            }
+            p = eol + 1;
+        }
+        free(buf);
+    }
+}
+
+/**
+ * Reading one column of all regular files in a directory, concatenated in the
+ * order of file names.
+ * @param dir
+ * @param col Value column.
+ * @param scol NSAMP column, col - scol * nspv is taken if scol >= 0.
+ * @param nspv
+ * @param nthread Files are read in parallel.
+ * @param len
+ * @param arr
+ */
+static int
+read_dir(char *dir, int col, int scol, double nspv, int nthread, u64 *len, i64 **arr) {
+    DIR *dp;
+    struct dirent *de;
+    agg_file_t *files = NULL;
+    u64 nfile = 0, nalloc = 0, off = 0;
+    agg_task_t at;
+    int err = 0;
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        printf("[FilT-agg] ERROR, cannot open directory %s.\n", dir);
+        return errno;
+    }
+    while ((de = readdir(dp)) != NULL) {
+        struct stat st;
+        char *path;
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        if (asprintf(&path, "%s/%s", dir, de->d_name) < 0) {
+            err = ENOMEM;
+            break;
+        }
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        if (nfile == nalloc) {
+            agg_file_t *nf;
+            nalloc = nalloc ? nalloc * 2 : 64;
+            nf = (agg_file_t *)realloc(files, nalloc * sizeof(agg_file_t));
+            if (nf == NULL) {
+                free(path);
+                err = ENOMEM;
+                break;
+            }
+            files = nf;
+        }
+        files[nfile].path = path;
+        files[nfile].arr = NULL;
+        files[nfile].len = 0;
+        files[nfile].err = 0;
+        nfile ++;
+    }
+    closedir(dp);
+    if (err == 0 && nfile == 0) {
+        printf("[FilT-agg] ERROR, no file in %s.\n", dir);
+        err = EINVAL;
+    }
+
+    if (err == 0) {
+        qsort(files, nfile, sizeof(agg_file_t), cmp_name);
+        at.files = files;
+        at.col = col;
+        at.scol = scol;
+        at.nspv = nspv;
+        filt_parallel_for(nthread, nfile, agg_task, &at);
+        *len = 0;
+        for (u64 i = 0; i < nfile; i ++) {
+            err = err ? err : files[i].err;
+            *len += files[i].len;
+        }
+    }
+    if (err == 0) {
+        *arr = (i64 *)malloc((*len ? *len : 1) * sizeof(i64));
+        if (*arr == NULL) {
+            err = errno;
+        }
+    }
+    for (u64 i = 0; i < nfile; i ++) {
+        if (err == 0) {
+            memcpy(*arr + off, files[i].arr, files[i].len * sizeof(i64));
+            off += files[i].len;
+        }
+        free(files[i].path);
+        free(files[i].arr);
+    }
+    free(files);
+    if (err == 0) {
+        printf("[FilT-agg] %lu files, %lu data points in %s.\n", nfile, *len, dir);
+    }
+
+    return err;
+}
+
+static FILE *
+open_out(char *out_dir, char *fname) {
+    char fpath[4096];
+    FILE *fp;
+
+    snprintf(fpath, sizeof(fpath), "%s/%s", out_dir, fname);
+    fp = fopen(fpath, "w");
+    if (fp == NULL) {
+        printf("[FilT-agg] ERROR, cannot open %s.\n", fpath);
+    }
+    return fp;
+}
+
+static int
+write_arr(char *out_dir, char *fname, i64 *arr, u64 len) {
+    FILE *fp = open_out(out_dir, fname);
+
+    if (fp == NULL) {
+        return errno;
+    }
+    for (u64 i = 0; i < len; i ++) {
+        fprintf(fp, "%ld\n", arr[i]);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int
+write_u64(char *out_dir, char *fname, u64 v) {
+    FILE *fp = open_out(out_dir, fname);
+
+    if (fp == NULL) {
+        return errno;
+    }
+    fprintf(fp, "%lu\n", v);
+    fclose(fp);
+    return 0;
+}
+
+// Linear interpolation between order statistics, as numpy.quantile does.
+static double
+quantile(i64 *sorted, u64 len, double q) {
+    double h = (double)(len - 1) * q;
+    u64 lo = (u64)h;
+
+    if (lo + 1 >= len) {
+        return (double)sorted[len-1];
+    }
+    return (double)sorted[lo] + (h - (double)lo) * (double)(sorted[lo+1] - sorted[lo]);
+}
+
+static int
+agg_met(agg_param_t *args) {
+    i64 *arr, *sorted;
+    u64 len, binw;
+    double tq, gap;
+    int err;
+
+    err = read_dir(args->met_dir, args->met_col, -1, 0, args->nthread, &len, &arr);
+    if (err) {
+        return err;
+    }
+    if (len == 0) {
+        printf("[FilT-agg] ERROR, no data point in %s.\n", args->met_dir);
+        free(arr);
+        return EINVAL;
+    }
+    err = write_arr(args->out_dir, "met.csv", arr, len);
+
+    sorted = (i64 *)malloc(len * sizeof(i64));
+    if (err == 0 && sorted == NULL) {
+        err = errno;
+    }
+    if (err == 0) {
+        memcpy(sorted, arr, len * sizeof(i64));
+        sort_i64(sorted, len, args->nthread);
+
+        // binw = max(10, (median - min) / 50), in multiples of 10.
+        gap = quantile(sorted, len, 0.5) - (double)sorted[0];
+        binw = (u64)(fmax(gap / 50, 10) / 10) * 10;
+        err = write_u64(args->out_dir, "binw.out", binw);
+        printf("[FilT-agg] binw=%lu\n", binw);
+    }
+    if (err == 0 && args->nspv > 0) {
+        tq = quantile(sorted, len, args->quant);
+        err = write_u64(args->out_dir, "nsamp.out", (u64)(tq / args->nspv));
+        printf("[FilT-agg] q%g=%.1f, nsamp=%lu\n", args->quant, tq, (u64)(tq / args->nspv));
+    }
+
+    free(sorted);
+    free(arr);
+    return err;
+}
+
+static int
+agg_tf(agg_param_t *args) {
+    i64 *arr;
+    u64 len;
+    int err;
+
+    if (args->nspv <= 0) {
+        printf("[FilT-agg] ERROR, --nspv is needed by tf.csv.\n");
+        return EINVAL;
+    }
+    err = read_dir(args->tf_dir, args->tf_col, args->nsamp_col, args->nspv, args->nthread,
+                   &len, &arr);
+    if (err) {
+        return err;
+    }
+    err = write_arr(args->out_dir, "tf.csv", arr, len);
+
+    free(arr);
+    return err;
+}
+
+int
+main(int argc, char **argv) {
+    agg_param_t args;
+    int err = 0;
+
+    args.met_dir = NULL;
+    args.tf_dir = NULL;
+    args.out_dir = ".";
+    args.met_col = 1;
+    args.nsamp_col = 1;
+    args.tf_col = 2;
+    args.nspv = 0;
+    args.quant = 0.5;
+    args.nthread = 1;
+    argp_parse(&argp, argc, argv, 0, 0, &args);
+    args.nthread = args.nthread < 1 ? 1 : args.nthread;
+
+    if (args.met_dir == NULL && args.tf_dir == NULL) {
+        printf("[FilT-agg] ERROR, nothing to do, expecting --met-dir or --tf-dir.\n");
+        return EINVAL;
+    }
+    if (args.met_dir != NULL) {
+        err = agg_met(&args);
+    }
+    if (err == 0 && args.tf_dir != NULL) {
+        err = agg_tf(&args);
+    }
+    if (err) {
+        printf("[FilT-agg] Aggregation returned with errors. ERRCODE %d\n", err);
+    }
+
+    return err;
+}
@@ -0,0 +1,536 @@
+/**
+ * @file filt-cli.c
+ * @author Key Liao
+ *
+ * Command-line front end of libfilt, builds filt.x.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include "argp.h"
+#include "filt.h"
+
+#define FILT_MAX_JOBS 1024                  // Largest --jobs, each worker is a thread.
+
+/*=== ARGP ===*/
+static struct argp_option options[] = {
+    {"met-file", 'm', "FILE", 0, "Input measurement file, raw little-endian int64 if named *.bin", 0},
+    {"sample-file", 's', "FILE", 0, "Input timing fluctuation file, raw little-endian int64 if named *.bin", 0},
+    {"width", 'w', "TIME", 0, "The least interval of a time bin (ns).", 0},
+    {"nsamp", 'n', "NSAMP", 0, "Number of samples in each optimization step", 0},
+    {"plow", 'l', "PROB", 0, "Lowest threshold of possibility of a data bin", 0},
+    {"cut-x", 'x', "PROB", 0, "Cut the highest probability of met array", 0},
+    {"cut-y", 'y', "PROB", 0, "Cut the highest probability of timing fluctuation array", 0},
+    {"cut-z", 'z', "PROB", 0, "Cut the highest probability in w-distance calculation", 0},
+    {"nthread", 't', "NUM", 0, "Number of threads in simulations", 0},
+    {"batch", 'b', "FILE", 0, "Manifest of 'met_file tf_file out_dir' jobs, each tf file is loaded once", 0},
+    {"jobs", 'j', "NUM", 0, "Number of concurrent jobs in batch mode", 0},
+    {"mode", 'M', "MODE", 0, "Forward model in calc_tr: mc (Monte Carlo, default) or conv (exact convolution)", 0},
+    {"seed", 'r', "SEED", 0, "Seed of the random generator, reproducible at any thread count", 0},
+    {"solver", 'A', "NAME", 0, "Solver of calc_tr: sweep (bin by bin, default) or em (global Richardson-Lucy)", 0},
+    {"niter", 'i', "NUM", 0, "Max iterations of the em solver (default 1000)", 0},
+    {"ntile", 'N', "NUM", 0, "Number of tiles in sim_cdf.csv (default 1000)", 0},
+    {"bootstrap", 'B', "N", 0, "Resample met and tf N times and write per-bin confidence intervals to tr_ci.csv", 0},
+    {"cache", 'c', 0, 0, "Load the tf file through a sorted binary cache next to it, keyed by its content and cut-y", 0},
+    {"adaptive", 'a', 0, 0, "Grow the samples of each bin up to NSAMP only while the Monte Carlo error is above the optimization gap", 0},
+    {"sketch", 'k', "K", OPTION_ARG_OPTIONAL, "Stream inputs into KLL sketches of size K (default 2048), memory grows with K and with the met range / width, not with the file size", 0},
+    {"quiet", 'q', 0, 0, "Print errors and the final results only", 0},
+    {"verbose", 'v', 0, 0, "Print every calc_tr bin and optimization step", 0},
+    {"profile", 'p', "FILE", OPTION_ARG_OPTIONAL, "Print the time spent in each phase, and write a JSON trace of every phase and calc_tr bin to FILE", 0},
+    {"follow", 'f', "SEC", OPTION_ARG_OPTIONAL, "Keep reading samples appended to the met file every SEC seconds (default 1), and update the results from the last estimate", 0},
+    {0}
+};
+
+static filt_prof_t cli_prof;
+static char *prof_file = NULL;     // JSON trace of --profile, NULL for the summary only.
+static double follow_sec = 0;       // Poll interval of --follow, 0 for a single run.
+static volatile sig_atomic_t follow_stop = 0;
+
+// Parser function
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    filt_param_t *args = state->input;
+
+    switch (key) {
+        case 'm':
+            args->in_tm_file = arg;
+            break;
+        case 's':
+            args->in_tf_file = arg;
+            break;
+        case 'w':
+            args->width = atoi(arg);
+            break;
+        case 'n':
+            args->nsamp = atoi(arg);
+            break;
+        case 'l':
+            args->p_low = atof(arg);
+            break;
+        case 'x':
+            args->p_xcut = atof(arg);
+            break;
+        case 'y':
+            args->p_ycut = atof(arg);
+            break;
+        case 'z':
+            args->p_zcut = atof(arg);
+            break;
+        case 't':
+            args->nthread = atoi(arg);
+            break;
+        case 'M':
+            if (strcmp(arg, "conv") == 0) {
+                args->mode = FILT_MODE_CONV;
+            } else if (strcmp(arg, "mc") == 0) {
+                args->mode = FILT_MODE_MC;
+            } else {
+                argp_error(state, "Unknown mode %s, expecting mc or conv.", arg);
+            }
+            break;
+        case 'b':
+            args->batch_file = arg;
+            break;
+        case 'j':
+            args->njob = atoi(arg);
+            if (args->njob < 1 || args->njob > FILT_MAX_JOBS) {
+                argp_error(state, "--jobs expects a number in [1, %d].", FILT_MAX_JOBS);
+            }
+            break;
+        case 'r':
+            args->seed = strtoull(arg, NULL, 10);
+            break;
+        case 'A':
+            if (strcmp(arg, "em") == 0) {
+                args->solver = FILT_SOLVER_EM;
+            } else if (strcmp(arg, "sweep") == 0) {
+                args->solver = FILT_SOLVER_SWEEP;
+            } else {
+                argp_error(state, "Unknown solver %s, expecting sweep or em.", arg);
+            }
+            break;
+        case 'N':
+            args->ntile = strtoull(arg, NULL, 10);
+            if (args->ntile < 1) {
+                argp_error(state, "--ntile expects a positive number.");
+            }
+            break;
+        case 'B':
+            args->nboot = strtoull(arg, NULL, 10);
+            break;
+        case 'c':
+            args->tf_cache = 1;
+            break;
+        case 'a':
+            args->adaptive = 1;
+            break;
+        case 'i':
+            args->niter = strtoull(arg, NULL, 10);
+            break;
+        case 'k':
+            args->sketch_k = arg == NULL ? 2048 : strtoull(arg, NULL, 10);
+            break;
+        case 'q':
+            filt_set_verbose(FILT_LOG_QUIET);
+            break;
+        case 'v':
+            filt_set_verbose(FILT_LOG_DEBUG);
+            break;
+        case 'p':
+            args->prof = &cli_prof;
+            prof_file = arg;
+            break;
+        case 'f':
+            follow_sec = arg == NULL ? 1 : atof(arg);
+            if (follow_sec <= 0) {
+                argp_error(state, "--follow expects a positive interval.");
+            }
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+// argp parser structure
+static struct argp argp = {options, parse_opt, NULL, NULL};
+
+
+/*=== BEGIN: Main Entry ===*/
+
+typedef struct FilT_Job_T {
+    char *tm_file, *tf_file, *out_dir;
+    filt_tfc_t tfc;         // Shared by the jobs of the same tf file.
+    int err;
+} filt_job_t;
+
+typedef struct FilT_Queue_T {
+    filt_param_t *args;
+    filt_job_t *jobs;
+    u64 njob;
+    u64 next;               // The next job to take, protected by lock.
+    pthread_mutex_t lock;
+} filt_queue_t;
+
+static int
+write_results(filt_param_t *args, char *out_dir, filt_result_t *res) {
+    char path[4096];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", out_dir, args->out_trh_file);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-main] Writing results to %s...", path);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        printf("[FilT-main] ERROR, cannot open %s.\n", path);
+        return errno;
+    }
+    for (u64 i = 0; i < res->tr_hist.nbin; i ++) {
+        fprintf(fp, "%ld, %lf\n", res->tr_hist.pbin[i].t, res->tr_hist.pbin[i].p);
+    }
+    fclose(fp);
+    FILT_LOG(FILT_LOG_INFO, "Done.\n");
+    snprintf(path, sizeof(path), "%s/%s", out_dir, args->out_sim_file);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-main] Writing verification simulation results to %s...", path);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        printf("[FilT-main] ERROR, cannot open %s.\n", path);
+        return errno;
+    }
+    for (u64 i = 0; i < res->ntile + 1; i ++) {
+        fprintf(fp, "%lu, %ld, %ld, %lf\n", i, res->sim_cdf[i], res->w_arr[i], res->wp_arr[i]);
+    }
+    fclose(fp);
+    for (int i = 0; i < 3; i ++) {
+        const char *name[3] = {"er.out", "ep.out", "wd.out"};
+        double val[3] = {res->er, res->ep, res->wd};
+        snprintf(path, sizeof(path), "%s/%s", out_dir, name[i]);
+        fp = fopen(path, "w");
+        if (fp == NULL) {
+            printf("[FilT-main] ERROR, cannot open %s.\n", path);
+            return errno;
+        }
+        fprintf(fp, "%f", val[i]);
+        fclose(fp);
+    }
+    if (res->nboot > 0) {
+        snprintf(path, sizeof(path), "%s/tr_ci.csv", out_dir);
+        fp = fopen(path, "w");
+        if (fp == NULL) {
+            printf("[FilT-main] ERROR, cannot open %s.\n", path);
+            return errno;
+        }
+        for (u64 i = 0; i < res->tr_hist.nbin; i ++) {
+            fprintf(fp, "%ld, %lf, %lf, %lf\n", res->tr_hist.pbin[i].t, res->tr_hist.pbin[i].p,
+                    res->p_lo[i], res->p_hi[i]);
+        }
+        fclose(fp);
+    }
+    if (filt_get_verbose() >= FILT_LOG_INFO) {
+        printf("Done. er=%f, ep=%f\n", res->er, res->ep);
+    } else {
+        printf("[FilT-main] %s: wd=%f, er=%f, ep=%f\n", out_dir, res->wd, res->er, res->ep);
+    }
+
+    return 0;
+}
+
+static void *
+batch_worker(void *arg) {
+    filt_queue_t *q = (filt_queue_t *)arg;
+
+    while (1) {
+        filt_job_t *job;
+        filt_param_t jargs = *q->args;
+        filt_result_t res;
+        i64 *tm_arr;
+        u64 tm_len;
+
+        pthread_mutex_lock(&q->lock);
+        job = q->next < q->njob ? &q->jobs[q->next ++] : NULL;
+        pthread_mutex_unlock(&q->lock);
+        if (job == NULL) {
+            break;
+        }
+        jargs.in_tm_file = job->tm_file;
+        jargs.in_tf_file = job->tf_file;
+        jargs.tfd = &job->tfc.tfd;
+        job->err = read_samples_prof(job->tm_file, jargs.p_xcut, jargs.nthread, jargs.prof,
+                                     &tm_len, &tm_arr);
+        if (job->err) {
+            printf("[FilT-batch] Error in reading %s. ERRCODE %d\n", job->tm_file, job->err);
+            continue;
+        }
+        job->err = filt_run(&jargs, tm_arr, tm_len, job->tfc.arr, job->tfc.len, &res);
+        free(tm_arr);
+        if (job->err == 0) {
+            mkdir(job->out_dir, 0755);
+            job->err = write_results(&jargs, job->out_dir, &res);
+            filt_result_free(&res);
+        }
+    }
+    return NULL;
+}
+
+static int
+run_batch(filt_param_t *args) {
+    FILE *fp;
+    char *line = NULL;
+    size_t cap = 0;
+    filt_job_t *jobs = NULL, *pjobs;
+    u64 njob = 0, nfail = 0;
+    int err = 0, nworker = args->njob < 1 ? 1 : args->njob > FILT_MAX_JOBS ? FILT_MAX_JOBS : args->njob;
+    pthread_t tids[nworker];
+    int created[nworker];
+    filt_queue_t q;
+
+    // Manifest: one "met_file tf_file out_dir" per line, # for comments.
+    fp = fopen(args->batch_file, "r");
+    if (fp == NULL) {
+        printf("[FilT-batch] ERROR, cannot open manifest %s.\n", args->batch_file);
+        return errno;
+    }
+    while (getline(&line, &cap, fp) > 0) {
+        char *sp, *f[3];
+        int nf = 0;
+        for (char *tok = strtok_r(line, " \t\r\n,", &sp); tok != NULL && nf < 3;
+             tok = strtok_r(NULL, " \t\r\n,", &sp)) {
+            if (tok[0] == '#') {
+                break;
+            }
+            f[nf ++] = tok;
+        }
+        if (nf == 0) {
+            continue;
+        }
+        if (nf < 3) {
+            printf("[FilT-batch] ERROR, expecting 'met_file tf_file out_dir' in %s.\n", args->batch_file);
+            err = EINVAL;
+            break;
+        }
+        pjobs = (filt_job_t *)realloc(jobs, (njob + 1) * sizeof(filt_job_t));
+        if (pjobs == NULL) {
+            printf("[FilT-batch] ERROR, job list allocation failed.\n");
+            err = ENOMEM;
+            break;
+        }
+        jobs = pjobs;
+        jobs[njob].tm_file = strdup(f[0]);
+        jobs[njob].tf_file = strdup(f[1]);
+        jobs[njob].out_dir = strdup(f[2]);
+        jobs[njob].tfc.arr = NULL;
+        jobs[njob].tfc.len = 0;
+        jobs[njob].err = 0;
+        njob ++;
+        // Counted before the check, so the cleanup below frees what was copied.
+        if (jobs[njob-1].tm_file == NULL || jobs[njob-1].tf_file == NULL || jobs[njob-1].out_dir == NULL) {
+            printf("[FilT-batch] ERROR, job allocation failed.\n");
+            err = ENOMEM;
+            break;
+        }
+    }
+    free(line);
+    fclose(fp);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-batch] %lu jobs, %d workers.\n", njob, nworker);
+
+    // Loading each distinct tf file once.
+    for (u64 i = 0; i < njob && err == 0; i ++) {
+        for (u64 j = 0; j < i; j ++) {
+            if (strcmp(jobs[j].tf_file, jobs[i].tf_file) == 0) {
+                jobs[i].tfc = jobs[j].tfc;
+                break;
+            }
+        }
+        if (jobs[i].tfc.arr == NULL) {
+            err = tfc_load(jobs[i].tf_file, args->p_ycut, args->nthread, args->tf_cache,
+                           args->prof, &jobs[i].tfc);
+        }
+    }
+
+    if (err == 0) {
+        q.args = args;
+        q.jobs = jobs;
+        q.njob = njob;
+        q.next = 0;
+        pthread_mutex_init(&q.lock, NULL);
+        // Worker 0 is the caller, which also drains the queue alone if no
+        // thread could be created.
+        for (int t = 1; t < nworker; t ++) {
+            created[t] = pthread_create(&tids[t], NULL, batch_worker, &q) == 0;
+        }
+        batch_worker(&q);
+        for (int t = 1; t < nworker; t ++) {
+            if (created[t]) {
+                pthread_join(tids[t], NULL);
+            }
+        }
+        pthread_mutex_destroy(&q.lock);
+        for (u64 i = 0; i < njob; i ++) {
+            if (jobs[i].err) {
+                printf("[FilT-batch] Job %s %s %s failed. ERRCODE %d\n",
+                        jobs[i].tm_file, jobs[i].tf_file, jobs[i].out_dir, jobs[i].err);
+                nfail ++;
+                err = jobs[i].err;
+            }
+        }
+        printf("[FilT-batch] %lu of %lu jobs done.\n", njob - nfail, njob);
+    }
+
+    // Releasing from the back, so the first job of a tf file, which owns it,
+    // is still intact when the later ones are checked.
+    for (u64 i = njob; i -- > 0; ) {
+        int owner = 1;
+        for (u64 j = 0; j < i; j ++) {
+            owner = owner && jobs[j].tfc.arr != jobs[i].tfc.arr;
+        }
+        if (owner && jobs[i].tfc.arr != NULL) {
+            tfc_free(&jobs[i].tfc);
+        }
+        free(jobs[i].tm_file);
+        free(jobs[i].tf_file);
+        free(jobs[i].out_dir);
+    }
+    free(jobs);
+
+    return err;
+}
+
+static void
+on_stop(int sig) {
+    (void)sig;
+    follow_stop = 1;
+}
+
+// Polling the met file, every batch of new samples updates the resident
+// tmh and trh, and the results are rewritten. Stops on SIGINT or SIGTERM.
+static int
+run_follow(filt_param_t *args) {
+    filt_tfc_t tfc;
+    filt_online_t ol;
+    u64 off = 0;
+    int err;
+
+    err = tfc_load(args->in_tf_file, args->p_ycut, args->nthread, args->tf_cache, args->prof, &tfc);
+    if (err) {
+        printf("[FilT-follow] Error in parsing timing fluctuations file. ERRCODE %d\n", err);
+        return err;
+    }
+    args->tfd = &tfc.tfd;
+    filt_online_init(&ol, args, tfc.arr, tfc.len);
+    signal(SIGINT, on_stop);
+    signal(SIGTERM, on_stop);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-follow] Following %s every %g s.\n", args->in_tm_file, follow_sec);
+
+    while (!follow_stop) {
+        filt_result_t res;
+        i64 *tm_arr;
+        u64 tm_len;
+
+        err = read_samples_from(args->in_tm_file, &off, &tm_len, &tm_arr);
+        if (err) {
+            break;
+        }
+        if (tm_len > 0) {
+            // A failed update keeps the last results, more samples may fix it.
+            if (filt_online_update(&ol, tm_arr, tm_len, &res) == 0) {
+                write_results(args, ".", &res);
+                filt_result_free(&res);
+            }
+            free(tm_arr);
+            continue;
+        }
+        usleep((useconds_t)(follow_sec * 1e6));
+    }
+    FILT_LOG(FILT_LOG_INFO, "[FilT-follow] %lu updates on %lu samples.\n", ol.nupdate, ol.ch.n);
+
+    filt_online_free(&ol);
+    tfc_free(&tfc);
+    args->tfd = NULL;
+    return err;
+}
+
+int
+main(int argc, char **argv){
+    filt_param_t args;
+    filt_result_t res;
+    int err;
+
+    filt_param_init(&args);
+
+    // Parse command line
+    argp_parse(&argp, argc, argv, 0, 0, &args);
+
+    if (args.prof != NULL) {
+        prof_init(args.prof, prof_file != NULL);
+    }
+    // The online updates warm-start the em solver.
+    if (follow_sec > 0) {
+        args.solver = FILT_SOLVER_EM;
+    }
+
+    if (args.batch_file == NULL) {
+        FILT_LOG(FILT_LOG_INFO, "[FilT-main] Met in file: %s\n", args.in_tm_file);
+        FILT_LOG(FILT_LOG_INFO, "[FilT-main] Timing fluctuation file: %s\n", args.in_tf_file);
+    } else {
+        FILT_LOG(FILT_LOG_INFO, "[FilT-main] Batch manifest: %s, jobs=%d\n", args.batch_file, args.njob);
+    }
+    FILT_LOG(FILT_LOG_INFO, "[FilT-main] p_low=%f, width=%lu, nsamp=%lu, "
+            "met_cut=%f, tf_cut=%f\n", 
+            args.p_low, args.width, args.nsamp, args.p_xcut, args.p_ycut);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-main] mode=%s, solver=%s, nthread=%d, seed=%lu\n",
+            args.mode == FILT_MODE_CONV ? "conv" : "mc",
+            args.solver == FILT_SOLVER_EM ? "em" : "sweep", args.nthread, args.seed);
+
+    if (args.batch_file != NULL) {
+        if (args.sketch_k > 0) {
+            printf("[FilT-main] ERROR, --sketch is not supported in batch mode.\n");
+            return EINVAL;
+        }
+        if (follow_sec > 0) {
+            printf("[FilT-main] ERROR, --follow is not supported in batch mode.\n");
+            return EINVAL;
+        }
+        err = run_batch(&args);
+        if (err) {
+            printf("[FilT-main] run_batch returned with errors. ERRCODE %d\n", err);
+        }
+        goto EXIT;
+    }
+
+    if (follow_sec > 0) {
+        err = run_follow(&args);
+        goto EXIT;
+    }
+
+    // Reading input files and estimating the real run time distribution.
+    if (args.sketch_k > 0) {
+        FILT_LOG(FILT_LOG_INFO, "[FilT-main] Streaming inputs, sketch k=%lu\n", args.sketch_k);
+        err = run_filt_sketch(&args, &res);
+    } else {
+        err = run_filt(&args, &res);
+    }
+
+    if (err == 0) {
+        err = write_results(&args, ".", &res);
+        filt_result_free(&res);
+    } else {
+        printf("[FilT-main] run_filt returned with errors. ERRCODE %d\n", err);
+    }
+
+EXIT:
+    if (args.prof != NULL) {
+        prof_print(args.prof);
+        if (prof_file != NULL) {
+            prof_write_json(args.prof, prof_file);
+        }
+        prof_free(args.prof);
+    }
+    return err;
+}
+
+/*=== END: Main Entry ===*/
@@ -9,204 +9,708 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#ifdef __linux__
-#include <error.h>
-#endif
-#ifdef __APPLE__
 #include <errno.h>
+#ifdef __APPLE__
+#include <libkern/OSByteOrder.h>
+#define le64toh(x) OSSwapLittleToHostInt64(x)
+#else
+#include <endian.h>
 #endif
 #include <math.h>
 #include <sys/time.h>
-#include "argp.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "filt.h"
 
-#ifndef NTILE
-#define NTILE 1000
-#endif
+/*=== BEGIN: Implementations ===*/
 
+int
+cmp(const void *a, const void *b) {
+    i64 x = *(const i64 *)a, y = *(const i64 *)b;
+    return (x > y) - (x < y);
+}
 
-/*=== ARGP ===*/
-static struct argp_option options[] = {
-    {"met-file", 'm', "FILE", 0, "Input measurement file", 0},
-    {"sample-file", 's', "FILE", 0, "Input timing fluctuation file", 0},
-    {"width", 'w', "TIME", 0, "The least interval of a time bin (ns).", 0},
-    {"nsamp", 'n', "NSAMP", 0, "Number of samples in each optimization step", 0},
-    {"plow", 'l', "PROB", 0, "Lowest threshold of possibility of a data bin", 0},
-    {"cut-x", 'x', "PROB", 0, "Cut the highest probability of met array", 0},
-    {"cut-y", 'y', "PROB", 0, "Cut the highest probability of timing fluctuation array", 0},
-    {"cut-z", 'z', "PROB", 0, "Cut the highest probability in w-distance calculation", 0},
-    {0}
-};
-
-// Parser function
-static error_t parse_opt(int key, char *arg, struct argp_state *state) {
-    filt_param_t *args = state->input;
-
-    switch (key) {
-        case 'm':
-            args->in_tm_file = arg;
-            break;
-        case 's':
-            args->in_tf_file = arg;
-            break;
-        case 'w':
-            args->width = atoi(arg);
-            break;
-        case 'n':
-            args->nsamp = atoi(arg);
-            break;
-        case 'l':
-            args->p_low = atof(arg);
-            break;
-        case 'x':
-            args->p_xcut = atof(arg);
-            break;
-        case 'y':
-            args->p_ycut = atof(arg);
-            break;
-        case 'z':
-            args->p_zcut = atof(arg);
-            break;
-        default:
-            return ARGP_ERR_UNKNOWN;
+typedef struct Radix_Task_T {
+    u64 *src, *dst;
+    u64 *cnt;               // nthread x 256 digit counts, then scatter offsets.
+    u64 *diff;              // nthread bits that differ from k0.
+    u64 k0;                 // src[0] flipped, read before any thread flips it.
+    int shift;
+} radix_task_t;
+
+static void
+radix_flip_task(void *arg, int ithread, u64 i0, u64 i1) {
+    radix_task_t *rt = (radix_task_t *)arg;
+    u64 d = 0;
+
+    // Flipping the sign bit makes signed order the unsigned order.
+    for (u64 i = i0; i < i1; i ++) {
+        rt->src[i] ^= 0x8000000000000000ULL;
+        d |= rt->src[i] ^ rt->k0;
+    }
+    if (rt->diff != NULL) {
+        rt->diff[ithread] = d;
     }
-    return 0;
 }
 
-// argp parser structure
-static struct argp argp = {options, parse_opt, NULL, NULL};
+static void
+radix_count_task(void *arg, int ithread, u64 i0, u64 i1) {
+    radix_task_t *rt = (radix_task_t *)arg;
+    u64 *cnt = rt->cnt + (u64)ithread * 256;
 
+    for (int d = 0; d < 256; d ++) {
+        cnt[d] = 0;
+    }
+    for (u64 i = i0; i < i1; i ++) {
+        cnt[(rt->src[i] >> rt->shift) & 0xFF] ++;
+    }
+}
 
-/*=== BEGIN: Implementations ===*/
+static void
+radix_scatter_task(void *arg, int ithread, u64 i0, u64 i1) {
+    radix_task_t *rt = (radix_task_t *)arg;
+    u64 *off = rt->cnt + (u64)ithread * 256;
 
-int
-cmp(const void *a, const void *b) {
-    return (*(int*)a - *(int*)b);
+    for (u64 i = i0; i < i1; i ++) {
+        u64 k = rt->src[i];
+        rt->dst[off[(k >> rt->shift) & 0xFF] ++] = k;
+    }
+}
+
+void
+sort_i64(i64 *arr, u64 n, int nthread) {
+    radix_task_t rt;
+    u64 *buf, diff = 0;
+
+    nthread = nthread < 1 ? 1 : nthread;
+    if (n < 1024) {
+        qsort(arr, n, sizeof(i64), cmp);
+        return;
+    }
+    buf = (u64 *)malloc(n * sizeof(u64));
+    rt.cnt = (u64 *)malloc((u64)nthread * 256 * sizeof(u64));
+    rt.diff = (u64 *)malloc((u64)nthread * sizeof(u64));
+    if (buf == NULL || rt.cnt == NULL || rt.diff == NULL) {
+        free(buf);
+        free(rt.cnt);
+        free(rt.diff);
+        qsort(arr, n, sizeof(i64), cmp);
+        return;
+    }
+    rt.src = (u64 *)arr;
+    rt.dst = buf;
+    rt.k0 = rt.src[0] ^ 0x8000000000000000ULL;
+    for (int t = 0; t < nthread; t ++) {
+        rt.diff[t] = 0;
+    }
+    filt_parallel_for(nthread, n, radix_flip_task, &rt);
+    for (int t = 0; t < nthread; t ++) {
+        diff |= rt.diff[t];
+    }
+
+    // LSD passes, one byte each. Bytes shared by all keys (the high bytes of
+    // nanosecond timings) are skipped.
+    for (rt.shift = 0; rt.shift < 64; rt.shift += 8) {
+        u64 off = 0;
+        u64 *tmp;
+        if (((diff >> rt.shift) & 0xFF) == 0) {
+            continue;
+        }
+        filt_parallel_for(nthread, n, radix_count_task, &rt);
+        for (int d = 0; d < 256; d ++) {
+            for (int t = 0; t < nthread; t ++) {
+                u64 c = rt.cnt[(u64)t * 256 + d];
+                rt.cnt[(u64)t * 256 + d] = off;
+                off += c;
+            }
+        }
+        filt_parallel_for(nthread, n, radix_scatter_task, &rt);
+        tmp = rt.src;
+        rt.src = rt.dst;
+        rt.dst = tmp;
+    }
+    if (rt.src != (u64 *)arr) {
+        memcpy(arr, rt.src, n * sizeof(u64));
+    }
+    rt.src = (u64 *)arr;
+    free(rt.diff);
+    rt.diff = NULL;
+    filt_parallel_for(nthread, n, radix_flip_task, &rt);
+
+    free(buf);
+    free(rt.cnt);
 }
 
 
 int
-sim_met(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, double *psim, u64 nsamp) {
+sampler_init(prob_hist_t *tmh, prob_hist_t *trh, filt_sampler_t *smp) {
     u64 nbin = tmh->nbin;
-    double *ptrhc, trpmax; // Cumulative probabilities of trh.
-    struct timeval tv;
 
-    ptrhc = (double *)malloc(nbin*sizeof(double));
+    smp->nbin = nbin;
+    smp->pc = (double *)malloc(nbin * sizeof(double));
+    smp->tr = (i64 *)malloc(nbin * sizeof(i64));
+    smp->tm = (i64 *)malloc(nbin * sizeof(i64));
+    if (smp->pc == NULL || smp->tr == NULL || smp->tm == NULL) {
+        printf("[FilT-sampler_init] ERROR, sampler allocation failed.\n");
+        sampler_free(smp);
+        return errno;
+    }
 
-    gettimeofday(&tv, NULL);
-    srand(tv.tv_sec * 1e6 + tv.tv_usec);
+    // Calculating tr's cumulative probability, and copying bin edges to
+    // contiguous arrays for the binary searches.
+    smp->pc[0] = 0.0;
+    for (u64 ir = 0; ir < nbin; ir ++) {
+        if (ir > 0) {
+            smp->pc[ir] = smp->pc[ir-1] + trh->pbin[ir-1].p;
+        }
+        smp->tr[ir] = trh->pbin[ir].t;
+        smp->tm[ir] = tmh->pbin[ir].t;
+    }
+    smp->pmax = smp->pc[nbin-1];
+
+    return 0;
+}
+
+void
+sampler_free(filt_sampler_t *smp) {
+    free(smp->pc);
+    free(smp->tr);
+    free(smp->tm);
+    smp->pc = NULL;
+    smp->tr = NULL;
+    smp->tm = NULL;
+}
 
-    // Calculating tr's cumulative probability
-    ptrhc[0] = 0.0;
-    psim[0] = 0;
-    for (u64 ir = 1; ir < nbin; ir ++) {
-        ptrhc[ir] = ptrhc[ir-1] + trh->pbin[ir-1].p;
-        psim[ir] = 0;
+i64
+sampler_draw_tr(filt_sampler_t *smp, double px) {
+    u64 lo = 0, hi = smp->nbin - 1;
+    double p0, p1, t0, t1;
+
+    // Find ir in [0, nbin-1) with pc[ir] <= px < pc[ir+1]. px beyond pmax
+    // falls into the last non-empty bin.
+    while (lo < hi) {
+        u64 mid = lo + (hi - lo) / 2;
+        if (px < smp->pc[mid+1]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
     }
-    trpmax = ptrhc[nbin-1];
-    
-    for (u64 isamp = 0; isamp < nsamp; isamp ++){
-        register double px = (double)rand() / (double)RAND_MAX;
-        if (px < trpmax) {
-            register i64 tf = tf_arr[(u64)((double)rand() / (double)RAND_MAX * (double)tf_len)];
-            for (u64 ir = 0; ir < nbin - 1; ir ++) {
-                if (px < ptrhc[ir+1]) {
-                    register i64 tsim;
-                    register double p0, p1, t0, t1, tx;
-                    p0 = ptrhc[ir];
-                    p1 = ptrhc[ir+1];
-                    t0 = trh->pbin[ir].t;
-                    t1 = trh->pbin[ir+1].t;
-                    tx = t0 + (px - p0) * (t1 - t0) / (p1 - p0);
-                    tsim = (i64)tx + tf;
-                    if (tsim >= trh->pbin[nbin-1].t) {
-                        psim[nbin-1] ++;
-                    } else {
-                        for (u64 im = 0; im < nbin - 1; im ++) {
-                            if (tsim < tmh->pbin[im+1].t) {
-                                psim[im] ++;
-                                break;
-                            }
-                        }
-                    }
-                    break;
-                }
+    if (lo >= smp->nbin - 1) {
+        lo = smp->nbin - 2;
+    }
+    p0 = smp->pc[lo];
+    p1 = smp->pc[lo+1];
+    t0 = smp->tr[lo];
+    t1 = smp->tr[lo+1];
+    if (p1 <= p0) {
+        return (i64)t0;
+    }
+    return (i64)(t0 + (px - p0) * (t1 - t0) / (p1 - p0));
+}
+
+u64
+sampler_bucket(filt_sampler_t *smp, i64 tsim) {
+    u64 lo = 0, hi = smp->nbin - 1;
+
+    if (tsim >= smp->tr[smp->nbin-1]) {
+        return smp->nbin - 1;
+    }
+    // The first im in [0, nbin-1) with tsim < tm[im+1], nbin if none.
+    while (lo < hi) {
+        u64 mid = lo + (hi - lo) / 2;
+        if (tsim < smp->tm[mid+1]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo < smp->nbin - 1 ? lo : smp->nbin;
+}
+
+void
+filt_rng_u01(u64 seed, u64 stream, u64 ctr, double *u) {
+    // Philox4x32-10, counter = (ctr, stream), key = seed.
+    u32 c0 = (u32)ctr, c1 = (u32)(ctr >> 32), c2 = (u32)stream, c3 = (u32)(stream >> 32);
+    u32 k0 = (u32)seed, k1 = (u32)(seed >> 32);
+
+    for (int r = 0; r < 10; r ++) {
+        u64 p0 = (u64)0xD2511F53U * c0;
+        u64 p1 = (u64)0xCD9E8D57U * c2;
+        c0 = (u32)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (u32)p1;
+        c2 = (u32)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (u32)p0;
+        k0 += 0x9E3779B9U;
+        k1 += 0xBB67AE85U;
+    }
+    // 53-bit mantissas, u in [0, 1).
+    u[0] = (double)((((u64)c0 << 32) | c1) >> 11) * 0x1.0p-53;
+    u[1] = (double)((((u64)c2 << 32) | c3) >> 11) * 0x1.0p-53;
+}
+
+typedef struct FilT_Task_T {
+    filt_task_fn fn;
+    void *arg;
+    int ithread;
+    u64 i0, i1;
+} filt_task_t;
+
+static void *
+filt_task_entry(void *ptask) {
+    filt_task_t *task = (filt_task_t *)ptask;
+    task->fn(task->arg, task->ithread, task->i0, task->i1);
+    return NULL;
+}
+
+void
+filt_parallel_for(int nthread, u64 n, filt_task_fn fn, void *arg) {
+    if (nthread <= 1 || n < (u64)nthread) {
+        fn(arg, 0, 0, n);
+        return;
+    }
+    pthread_t tids[nthread];
+    filt_task_t tasks[nthread];
+    int created[nthread];
+
+    for (int t = 0; t < nthread; t ++) {
+        tasks[t].fn = fn;
+        tasks[t].arg = arg;
+        tasks[t].ithread = t;
+        tasks[t].i0 = n * t / nthread;
+        tasks[t].i1 = n * (t + 1) / nthread;
+    }
+    // Thread 0 runs in the caller, a failed spawn falls back to the caller too.
+    for (int t = 1; t < nthread; t ++) {
+        created[t] = pthread_create(&tids[t], NULL, filt_task_entry, &tasks[t]) == 0;
+    }
+    filt_task_entry(&tasks[0]);
+    for (int t = 1; t < nthread; t ++) {
+        if (created[t]) {
+            pthread_join(tids[t], NULL);
+        } else {
+            filt_task_entry(&tasks[t]);
+        }
+    }
+}
+
+int
+tfd_init(filt_tfd_t *tfd, i64 *tf_arr, u64 tf_len) {
+    u64 range = (u64)(tf_arr[tf_len-1] - tf_arr[0]);
+
+    tfd->base = tf_arr[0];
+    tfd->len = tf_len;
+    tfd->bits = range <= UINT16_MAX ? 16 : range <= UINT32_MAX ? 32 : 0;
+    tfd->off = NULL;
+    if (tfd->bits == 0) {
+        return 0;
+    }
+    tfd->off = malloc(tf_len * (tfd->bits / 8));
+    if (tfd->off == NULL) {
+        printf("[FilT-tfd_init] ERROR, offset array allocation failed.\n");
+        tfd->bits = 0;
+        return errno;
+    }
+    if (tfd->bits == 16) {
+        uint16_t *off = (uint16_t *)tfd->off;
+        for (u64 i = 0; i < tf_len; i ++) {
+            off[i] = (uint16_t)(tf_arr[i] - tf_arr[0]);
+        }
+    } else {
+        u32 *off = (u32 *)tfd->off;
+        for (u64 i = 0; i < tf_len; i ++) {
+            off[i] = (u32)(tf_arr[i] - tf_arr[0]);
+        }
+    }
+    return 0;
+}
+
+void
+tfd_free(filt_tfd_t *tfd) {
+    free(tfd->off);
+    tfd->off = NULL;
+    tfd->bits = 0;
+}
+
+// tf sample i, from the compact copy if there is one. The width test is the
+// same for every draw of a simulation, so it is always predicted.
+static inline i64
+tf_at(const filt_tfd_t *tfd, const i64 *tf_arr, u64 i) {
+    if (tfd != NULL && tfd->bits == 16) {
+        return tfd->base + ((const uint16_t *)tfd->off)[i];
+    }
+    if (tfd != NULL && tfd->bits == 32) {
+        return tfd->base + ((const u32 *)tfd->off)[i];
+    }
+    return tf_arr[i];
+}
+
+typedef struct Sim_Task_T {
+    filt_sampler_t *smp;
+    i64 *tf_arr;
+    const filt_tfd_t *tfd;  // Compact tf_arr, or NULL.
+    u64 tf_len;
+    u64 seed, stream;
+    u64 *cnts;              // sim_met: nthread partial histograms of nbin counts.
+    i64 *sim_arr;           // sim_verify: simulated times, one per sample.
+} sim_task_t;
+
+static void
+sim_met_task(void *arg, int ithread, u64 i0, u64 i1) {
+    sim_task_t *st = (sim_task_t *)arg;
+    filt_sampler_t *smp = st->smp;
+    u64 nbin = smp->nbin;
+    u64 *cnt = st->cnts + (u64)ithread * nbin;
+
+    for (u64 isamp = i0; isamp < i1; isamp ++) {
+        double u[2];
+        filt_rng_u01(st->seed, st->stream, isamp, u);
+        if (u[0] < smp->pmax) {
+            register i64 tf = tf_at(st->tfd, st->tf_arr, (u64)(u[1] * (double)st->tf_len));
+            register u64 im = sampler_bucket(smp, sampler_draw_tr(smp, u[0]) + tf);
+            if (im < nbin) {
+                cnt[im] ++;
             }
         }
     }
+}
+
+static void
+sim_verify_task(void *arg, int ithread, u64 i0, u64 i1) {
+    sim_task_t *st = (sim_task_t *)arg;
+    (void)ithread;
+
+    for (u64 isamp = i0; isamp < i1; isamp ++) {
+        double u[2];
+        filt_rng_u01(st->seed, st->stream, isamp, u);
+        // mul pmax instead of 1, to tackle the little error from pmax to 1.0
+        register i64 tf = tf_at(st->tfd, st->tf_arr, (u64)(u[1] * (double)st->tf_len));
+        st->sim_arr[isamp] = sampler_draw_tr(st->smp, u[0] * st->smp->pmax) + tf;
+    }
+}
+
+int
+sim_met(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, double *psim, u64 nsamp,
+        filt_mc_t *mc) {
+    u64 nbin = tmh->nbin;
+    int nthread = mc->nthread < 1 ? 1 : mc->nthread;
+    filt_sampler_t smp;
+    sim_task_t st;
+    int err;
+
+    err = sampler_init(tmh, trh, &smp);
+    if (err) {
+        return err;
+    }
+    st.smp = &smp;
+    st.tf_arr = tf_arr;
+    st.tfd = mc->tfd != NULL && mc->tfd->len == tf_len ? mc->tfd : NULL;
+    st.tf_len = tf_len;
+    st.seed = mc->seed;
+    st.stream = mc->stream ++;
+    st.sim_arr = NULL;
+    st.cnts = (u64 *)calloc((u64)nthread * nbin, sizeof(u64));
+    if (st.cnts == NULL) {
+        printf("[FilT-sim_met] ERROR, partial histogram allocation failed.\n");
+        sampler_free(&smp);
+        return errno;
+    }
 
+    filt_parallel_for(nthread, nsamp, sim_met_task, &st);
+
+    // Merging partial histograms, counts are integers so the sum does not
+    // depend on the number of threads.
     for (u64 isim = 0; isim < nbin; isim ++) {
-        // printf("%f ", psim[isim]);
-        psim[isim] = psim[isim] / (double)nsamp;
+        u64 cnt = 0;
+        for (int t = 0; t < nthread; t ++) {
+            cnt += st.cnts[(u64)t * nbin + isim];
+        }
+        psim[isim] = (double)cnt / (double)nsamp;
     }
 
-    free(ptrhc);
+    free(st.cnts);
+    sampler_free(&smp);
 
     return 0;
 }
 
 
+typedef struct Sim_Bin_Task_T {
+    filt_sampler_t *smp;
+    i64 *tf_arr;
+    const filt_tfd_t *tfd;  // Compact tf_arr, or NULL.
+    u64 tf_len;
+    u64 seed, stream;
+    i64 tr_l, tr_r;         // The simulated trh bin [tr_l, tr_r).
+    u64 *cnts;
+} sim_bin_task_t;
+
+static void
+sim_met_bin_task(void *arg, int ithread, u64 i0, u64 i1) {
+    sim_bin_task_t *st = (sim_bin_task_t *)arg;
+    u64 nbin = st->smp->nbin;
+    u64 *cnt = st->cnts + (u64)ithread * nbin;
+    double tw = (double)(st->tr_r - st->tr_l);
+
+    for (u64 isamp = i0; isamp < i1; isamp ++) {
+        double u[2];
+        filt_rng_u01(st->seed, st->stream, isamp, u);
+        register i64 tf = tf_at(st->tfd, st->tf_arr, (u64)(u[1] * (double)st->tf_len));
+        register u64 im = sampler_bucket(st->smp, st->tr_l + (i64)(u[0] * tw) + tf);
+        if (im < nbin) {
+            cnt[im] ++;
+        }
+    }
+}
+
 int
-sim_verify(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, i64 *sim_cdf, u64 nsamp) {
+sim_met_bin(prob_hist_t *tmh, prob_hist_t *trh, u64 ir, i64 *tf_arr, u64 tf_len, double *pcol,
+            u64 nsamp, filt_mc_t *mc) {
     u64 nbin = tmh->nbin;
-    i64 *sim_arr;
-    double *ptrhc, trpmax; // Cumulative probabilities of trh.
-    struct timeval tv;
+    int nthread = mc->nthread < 1 ? 1 : mc->nthread;
+    filt_sampler_t smp;
+    sim_bin_task_t st;
+    int err;
+
+    err = sampler_init(tmh, trh, &smp);
+    if (err) {
+        return err;
+    }
+    st.smp = &smp;
+    st.tf_arr = tf_arr;
+    st.tfd = mc->tfd != NULL && mc->tfd->len == tf_len ? mc->tfd : NULL;
+    st.tf_len = tf_len;
+    st.seed = mc->seed;
+    st.stream = mc->stream ++;
+    st.tr_l = trh->pbin[ir].t;
+    st.tr_r = trh->pbin[ir+1].t;
+    st.cnts = (u64 *)calloc((u64)nthread * nbin, sizeof(u64));
+    if (st.cnts == NULL) {
+        printf("[FilT-sim_met_bin] ERROR, partial histogram allocation failed.\n");
+        sampler_free(&smp);
+        return errno;
+    }
 
-    ptrhc = (double *)malloc(nbin*sizeof(double));
-    sim_arr = (i64 *)malloc(nsamp*sizeof(i64));
+    filt_parallel_for(nthread, nsamp, sim_met_bin_task, &st);
 
-    gettimeofday(&tv, NULL);
-    srand(tv.tv_sec * 1e6 + tv.tv_usec);
+    for (u64 im = 0; im < nbin; im ++) {
+        u64 cnt = 0;
+        for (int t = 0; t < nthread; t ++) {
+            cnt += st.cnts[(u64)t * nbin + im];
+        }
+        pcol[im] = (double)cnt / (double)nsamp;
+    }
+
+    free(st.cnts);
+    sampler_free(&smp);
+
+    return 0;
+}
 
-    // Calculating tr's cumulative probability
-    ptrhc[0] = 0.0;
-    for (u64 ir = 1; ir < nbin; ir ++) {
-        ptrhc[ir] = ptrhc[ir-1] + trh->pbin[ir-1].p;
+
+int
+sim_verify(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, u64 ntile, i64 *sim_cdf,
+           u64 nsamp, filt_mc_t *mc, i64 **sim_sorted) {
+    filt_sampler_t smp;
+    sim_task_t st;
+    int err;
+
+    err = sampler_init(tmh, trh, &smp);
+    if (err) {
+        return err;
     }
-    trpmax = ptrhc[nbin-1];
-    
-    for (u64 isamp = 0; isamp < nsamp; isamp ++){
-        // mul trpmax instead of 1, to tackle the little error from trpmax to 1.0
-        register double px = (double)rand() / (double)RAND_MAX * trpmax;
-        register i64 tf = tf_arr[(u64)((double)rand() / (double)RAND_MAX * (double)tf_len)];
-        for (u64 ir = 0; ir < nbin - 1; ir ++) {
-            if (px < ptrhc[ir+1]) {
-                register i64 tsim;
-                register double p0, p1, t0, t1, tx;
-                p0 = ptrhc[ir];
-                p1 = ptrhc[ir+1];
-                t0 = trh->pbin[ir].t;
-                t1 = trh->pbin[ir+1].t;
-                tx = t0 + (px - p0) * (t1 - t0) / (p1 - p0);
-                sim_arr[isamp] = (i64)tx + tf;
-                break;
-            }
-        }
+    st.smp = &smp;
+    st.tf_arr = tf_arr;
+    st.tfd = mc->tfd != NULL && mc->tfd->len == tf_len ? mc->tfd : NULL;
+    st.tf_len = tf_len;
+    st.seed = mc->seed;
+    st.stream = mc->stream ++;
+    st.cnts = NULL;
+    st.sim_arr = (i64 *)malloc(nsamp*sizeof(i64));
+    if (st.sim_arr == NULL) {
+        printf("[FilT-sim_verify] ERROR, sim_arr allocation failed.\n");
+        sampler_free(&smp);
+        return errno;
     }
 
-    qsort(sim_arr, nsamp, sizeof(i64), cmp);
+    filt_parallel_for(mc->nthread, nsamp, sim_verify_task, &st);
 
-    for (int i = 0; i < NTILE; i ++) {
-        sim_cdf[i] = sim_arr[abs((int)(((double)i/(double)NTILE)*(double)nsamp))];
+    // calc_w merges every sample in order, the tiles are read off it.
+    sort_i64(st.sim_arr, nsamp, mc->nthread);
+    for (u64 i = 0; i < ntile; i ++) {
+        sim_cdf[i] = st.sim_arr[(u64)(((double)i / (double)ntile) * (double)nsamp)];
     }
-    sim_cdf[NTILE] = sim_arr[nsamp-1];
+    sim_cdf[ntile] = st.sim_arr[nsamp-1];
+    *sim_sorted = st.sim_arr;
+    sampler_free(&smp);
 
-    free(sim_arr);
-    free(ptrhc);
+    return 0;
+}
+
+int
+conv_init(prob_hist_t *tmh, i64 *tf_arr, u64 tf_len, i64 width, filt_conv_t *conv) {
+    u64 nbin = tmh->nbin, nh;
+    double *h, hc = 0, w = (double)width;
+
+    conv->nbin = nbin;
+    conv->cell = (u64 *)malloc(nbin * sizeof(u64));
+    if (conv->cell == NULL) {
+        printf("[FilT-conv_init] ERROR, conv->cell allocation failed.\n");
+        return errno;
+    }
+    // Left edge of each tmh bin on the width grid. trh shares the same cells,
+    // shifted by tf_arr[0].
+    for (u64 i = 0; i < nbin; i ++) {
+        conv->cell[i] = (u64)((tmh->pbin[i].t - tmh->pbin[0].t) / width);
+    }
+
+    // Binning tf onto the grid. A tr uniform in one cell plus tf = tf0 + q*w + r
+    // lands in cell q with (w-r)/w, and in cell q+1 with r/w.
+    nh = (u64)((tf_arr[tf_len-1] - tf_arr[0]) / width) + 2;
+    h = (double *)calloc(nh, sizeof(double));
+    conv->hh = (double *)malloc((nh + 2) * sizeof(double));
+    if (h == NULL || conv->hh == NULL) {
+        printf("[FilT-conv_init] ERROR, tf kernel allocation failed.\n");
+        free(h);
+        conv_free(conv);
+        return errno;
+    }
+    for (u64 i = 0; i < tf_len; i ++) {
+        i64 d = tf_arr[i] - tf_arr[0];
+        u64 q = (u64)(d / width);
+        double r = (double)(d % width);
+        h[q] += (w - r) / w;
+        h[q+1] += r / w;
+    }
+    // hh[j] = sum_{j'<j} H[j'], H[j] = sum_{j'<j} h[j'], so a range of cells
+    // in a tr bin convolved to a range of cells in a tm bin is O(1).
+    conv->nh = nh;
+    conv->hh[0] = 0;
+    for (u64 j = 0; j <= nh; j ++) {
+        conv->hh[j+1] = conv->hh[j] + hc;
+        if (j < nh) {
+            hc += h[j] / (double)tf_len;
+        }
+    }
+    free(h);
 
     return 0;
 }
 
+void
+conv_free(filt_conv_t *conv) {
+    free(conv->cell);
+    free(conv->hh);
+    conv->cell = NULL;
+    conv->hh = NULL;
+}
+
+static inline double
+conv_hh(filt_conv_t *conv, i64 j) {
+    if (j <= 0) {
+        return 0;
+    }
+    if ((u64)j <= conv->nh + 1) {
+        return conv->hh[j];
+    }
+    // H[j] = 1 beyond the kernel.
+    return conv->hh[conv->nh+1] + (double)((u64)j - conv->nh - 1);
+}
+
+void
+conv_met_bin(filt_conv_t *conv, u64 ir, double p, double *psim) {
+    u64 nbin = conv->nbin;
+    i64 k0 = conv->cell[ir], k1 = conv->cell[ir+1];
+    double pin = 0;
+
+    if (p <= 0 || k1 <= k0) {
+        return;
+    }
+    // tm >= tr, so bins on the left of ir get nothing.
+    for (u64 im = ir; im < nbin - 1; im ++) {
+        i64 n0 = conv->cell[im], n1 = conv->cell[im+1];
+        double pm = p / (double)(k1 - k0) *
+                    (conv_hh(conv, n1 - k0 + 1) - conv_hh(conv, n0 - k0 + 1)
+                     - conv_hh(conv, n1 - k1 + 1) + conv_hh(conv, n0 - k1 + 1));
+        psim[im] += pm;
+        pin += pm;
+    }
+    // Whatever goes beyond the histogram is kept in the last bin, as sim_met does.
+    psim[nbin-1] += p - pin > 0 ? p - pin : 0;
+}
+
+void
+conv_met(filt_conv_t *conv, prob_hist_t *trh, double *psim) {
+    for (u64 im = 0; im < conv->nbin; im ++) {
+        psim[im] = 0;
+    }
+    for (u64 ir = 0; ir < conv->nbin - 1; ir ++) {
+        conv_met_bin(conv, ir, trh->pbin[ir].p, psim);
+    }
+}
+
+static int
+calc_tr_col(prob_hist_t *tmh, prob_hist_t *trh, u64 ir, double p, i64 *tf_arr, u64 tf_len,
+            double *pcol, filt_param_t *args, filt_mc_t *mc, filt_conv_t *conv, u64 *nused) {
+    u64 nbin = tmh->nbin, ntot, nadd;
+    double dp_min = fabs(0.01 * args->p_low), padd[nbin];
+    int err;
+
+    if (args->mode == FILT_MODE_CONV) {
+        for (u64 im = 0; im < conv->nbin; im ++) {
+            pcol[im] = 0;
+        }
+        conv_met_bin(conv, ir, 1.0, pcol);
+        return 0;
+    }
+    if (!args->adaptive) {
+        *nused += args->nsamp;
+        return sim_met_bin(tmh, trh, ir, tf_arr, tf_len, pcol, args->nsamp, mc);
+    }
+
+    // Adaptive: doubling the samples while the standard error of p * pcol[ir]
+    // is above dp_min, up to args->nsamp.
+    ntot = args->nsamp < FILT_ADAPT_NSAMP0 ? args->nsamp : FILT_ADAPT_NSAMP0;
+    err = sim_met_bin(tmh, trh, ir, tf_arr, tf_len, pcol, ntot, mc);
+    while (err == 0 && ntot < args->nsamp) {
+        double q = pcol[ir];
+        if (p * sqrt(q * (1 - q) / (double)ntot) <= dp_min) {
+            break;
+        }
+        nadd = ntot < args->nsamp - ntot ? ntot : args->nsamp - ntot;
+        err = sim_met_bin(tmh, trh, ir, tf_arr, tf_len, padd, nadd, mc);
+        for (u64 im = 0; im < nbin && err == 0; im ++) {
+            pcol[im] = (pcol[im] * (double)ntot + padd[im] * (double)nadd) / (double)(ntot + nadd);
+        }
+        ntot += nadd;
+    }
+    FILT_LOG(FILT_LOG_DEBUG, "[FilT-calc_tr] nsamp=%lu\n", ntot);
+    *nused += ntot;
+    return err;
+}
+
 int
-calc_tr(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_t *args){
+calc_tr(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_t *args,
+        filt_mc_t *mc, double *ep){
 		
 	u64 nbin, imb;
 	int err = 0;
 	double tot_p = 0.0;	// Tracking total probability in trh for the exit condition
-	double simh[tmh->nbin], simh2[tmh->nbin];	// Simulated probabilities
+	double simh[tmh->nbin];	// Simulated probabilities of the fixed bins
+    double pcol[tmh->nbin]; // Simulated probabilities of a unit mass in the current bin
     double dp_min;
+    filt_conv_t conv;
+    u64 nused = 0;          // Samples drawn by all simulations.
 
+    if (args->solver == FILT_SOLVER_EM) {
+        double t0 = prof_now();
+        err = calc_tr_em(tmh, trh, tf_arr, tf_len, args, ep);
+        prof_add(args->prof, FILT_PROF_CALC_TR, -1, t0);
+        return err;
+    }
     dp_min = fabs(0.01 * args->p_low); // The min probability gap of optimization
 
 	// Init trh
@@ -223,13 +727,25 @@ calc_tr(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_
 		trh->pbin[i].p = 0.0;
         simh[i] = 0;
 	}
+    if (args->mode == FILT_MODE_CONV) {
+        err = conv_init(tmh, tf_arr, tf_len, args->width, &conv);
+        if (err) {
+            printf("[FilT-calc_tr] ERROR, building the convolution kernel failed.\n");
+            free(trh->pbin);
+            trh->nbin = 0;
+            trh->pbin = NULL;
+            return err;
+        }
+    }
 
-	// Loop over each time section in trh
+	// Loop over each time section in trh. The forward model is linear in
+	// trh, so the fixed bins are cached in simh and only bin imb is simulated.
     imb = 0;
 	while (imb < nbin - 1) {
 		i64 tr_l = trh->pbin[imb].t, tr_r = trh->pbin[imb+1].t; // tr in [tr_l, tr_r)
         double p, tr_p = 0;
         double dp, dmdr, dp0, dp1;
+        double t0 = prof_now();
 
         // ====== S1: Initial condition ======
         p = tmh->pbin[imb].p - simh[imb];
@@ -239,38 +755,42 @@ calc_tr(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_
             continue;
         }
         trh->pbin[imb].p = p;
-        printf("[FilT-calc_tr] IMB=%lld, [%lld, %lld), tr_p=%f\n", imb, tr_l, tr_r, p);
-        fflush(stdout);
+        FILT_LOG(FILT_LOG_DEBUG, "[FilT-calc_tr] IMB=%lu, [%ld, %ld), tr_p=%f\n", imb, tr_l, tr_r, p);
 
         // ====== S2: Optimization ======
-        sim_met(tmh, trh, tf_arr, tf_len, simh2, args->nsamp);
-        dp = simh2[imb] - tmh->pbin[imb].p;
-        dmdr = (simh2[imb] - simh[imb]) / trh->pbin[imb].p;
-        printf("[FilT-calc_tr] bin_p=%f, delta_p=%f, dmdr=%f\n", trh->pbin[imb].p, dp, dmdr);
+        err = calc_tr_col(tmh, trh, imb, p, tf_arr, tf_len, pcol, args, mc, &conv, &nused);
+        if (err) {
+            printf("[FilT-calc_tr] ERROR, simulating bin %lu failed.\n", imb);
+            break;
+        }
+        dp = simh[imb] + p * pcol[imb] - tmh->pbin[imb].p;
+        dmdr = pcol[imb];
+        FILT_LOG(FILT_LOG_DEBUG, "[FilT-calc_tr] bin_p=%f, delta_p=%f, dmdr=%f\n", trh->pbin[imb].p, dp, dmdr);
         dp0 = 0x7fffffff;
         dp1 = dp;
-        do {
+        tr_p = p;
+        while (dmdr > 0) {
             tr_p = trh->pbin[imb].p;
             trh->pbin[imb].p -= dp1 / dmdr;
             dp0 = dp1;
-            for (u64 isimh = 0; isimh < nbin; isimh ++) {
-                simh[isimh] = simh2[isimh];
-            }
             if (trh->pbin[imb].p <= 0) {
                 // We do not want nagative probability
                 dp1 = 0; // Don't sim, exit.
                 break;
             } else {
-                sim_met(tmh, trh, tf_arr, tf_len, simh2, args->nsamp);
-                dp1 = simh2[imb] - tmh->pbin[imb].p;
-                printf("[FilT-calc_tr] bin_p=%f, delta_p=%f\n", trh->pbin[imb].p, dp1);
+                dp1 = simh[imb] + trh->pbin[imb].p * pcol[imb] - tmh->pbin[imb].p;
+                FILT_LOG(FILT_LOG_DEBUG, "[FilT-calc_tr] bin_p=%f, delta_p=%f\n", trh->pbin[imb].p, dp1);
             }
             // If the gap <= dp_min, no further optimization.
             if (fabs(dp1) <= dp_min) {
                 tr_p = trh->pbin[imb].p;
                 break;
             }
-        } while (fabs(dp0) > fabs(dp1));
+            if (fabs(dp0) <= fabs(dp1)) {
+                break;
+            }
+        }
+        prof_add(args->prof, FILT_PROF_CALC_TR, (i64)imb, t0);
         tot_p += tr_p;
         // exit condition
         if (tot_p >= 1.0) {
@@ -284,90 +804,327 @@ calc_tr(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_
             break;
         } else {
             trh->pbin[imb].p = tr_p;
-            printf("[FilT-calc_tr] p=%f, tot_p=%f\n", trh->pbin[imb].p, tot_p);
-            fflush(stdout);
+            for (u64 im = imb; im < nbin; im ++) {
+                simh[im] += tr_p * pcol[im];
+            }
+            FILT_LOG(FILT_LOG_DEBUG, "[FilT-calc_tr] p=%f, tot_p=%f\n", trh->pbin[imb].p, tot_p);
             imb ++;
         }
 	}
-    ep = fabs(tot_p - 1);
-    printf("[FilT-calc_tr] tot_p=%f, Normalizing probabilities...", tot_p);
+    *ep = fabs(tot_p - 1);
+    if (args->mode == FILT_MODE_MC) {
+        FILT_LOG(FILT_LOG_INFO, "[FilT-calc_tr] %lu samples simulated.\n", nused);
+    }
+    FILT_LOG(FILT_LOG_INFO, "[FilT-calc_tr] tot_p=%f, Normalizing probabilities...", tot_p);
     fflush(stdout);
     for (u64 i = 0; i < trh->nbin; i ++) {
         trh->pbin[i].p /= tot_p;
     } 
-    printf("Done.\n");
+    FILT_LOG(FILT_LOG_INFO, "Done.\n");
     fflush(stdout);
+    if (args->mode == FILT_MODE_CONV) {
+        conv_free(&conv);
+    }
 
 	return err;
 }
 
-int
-slice(i64 *arr, u64 len, double p_low, i64 width, prob_hist_t *phist){
-    struct timeval st, en;
-    int err = 0;
-    i64 tmin, tmax; // The max and min in arr.
-    u64 ibin, nbin, nc_low, nbv, nc; // init bin count, lowest point count, valid nbin
-    i64 *pbins;     // Left edge of each bin.
-    u64 *pcnts;    // Point counts of each bin.
-
-    // For a phist = [[t0, p0], [t1, p1], ..., [t(n-1), p(n-1)]], it means for a
-    // random measurement result t, the probability t in [t0, t1) is p0.
-    // For any p in phist, p >= p_low except for p(n-1)≡0
-    // t[i] - t[i-1] is always a positive multiple to width
-
-    // Counting
-    tmin = arr[0];
-    tmax = arr[len-1];
-    
-    nbin = (u64)((float)(tmax - tmin) / (float)width);
-    nbin = nbin < 2? 2: nbin + 1;
-    printf("[FilT-slice] nbin=%llu, tmin=%lld, tmax=%lld \n", nbin, tmin, tmax);
-
-    // Corner case, only 1 or 2 bin
-    if (nbin <= 2) {
-        phist->nbin = nbin;
-        phist->pbin = (prob_bin_t *)malloc(nbin * sizeof(prob_bin_t));
-        if (phist->pbin == NULL) {
-            printf("[FilT-slice] ERROR, phist->pbin allocation failed.\n");
-            err = errno;
-            return err;
+typedef struct EM_Task_T {
+    u64 nbin;
+    filt_conv_t *conv;
+    double *a;              // Response of trh bin ir in tmh bin im, a[im*nbin+ir].
+    double *at;             // Transpose of a, at[ir*nbin+im].
+    double *colsum;         // sum_im a[im][ir].
+    u64 *lo, *hi;           // Nonzero band, a[im][ir] > 0 only for lo[im] <= ir and im <= hi[ir].
+    double *tm;             // tmh probabilities.
+    double *x;              // trh probabilities.
+    double *sim;            // a x.
+    double *ratio;          // tm / sim.
+} em_task_t;
+
+static void
+em_build_task(void *arg, int ithread, u64 i0, u64 i1) {
+    em_task_t *et = (em_task_t *)arg;
+    u64 n = et->nbin;
+
+    for (u64 ir = i0; ir < i1; ir ++) {
+        double *col = et->at + ir * n, cs = 0;
+        for (u64 im = 0; im < n; im ++) {
+            col[im] = 0;
         }
-		phist->pbin[nbin-1].t = tmax + 1;
-        phist->pbin[nbin-1].p = 0;
-        phist->pbin[0].t = tmin;
-        phist->pbin[0].p = 1.0;
+        if (ir < n - 1) {
+            conv_met_bin(et->conv, ir, 1.0, col);
+        }
+        et->hi[ir] = ir;
+        for (u64 im = 0; im < n; im ++) {
+            et->a[im*n+ir] = col[im];
+            cs += col[im];
+            if (col[im] > 0 && im < n - 1) {
+                et->hi[ir] = im;
+            }
+        }
+        et->colsum[ir] = cs;
+    }
+}
 
-		return err;
+// Four partial sums, so the loop is not bound by the latency of one add chain.
+static inline double
+em_dot(const double *a, const double *b, u64 n) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    u64 i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i+1] * b[i+1];
+        s2 += a[i+2] * b[i+2];
+        s3 += a[i+3] * b[i+3];
     }
-    
-    pbins = (i64 *)malloc(nbin * sizeof(i64));
-    pcnts = (u64 *)malloc(nbin * sizeof(u64));
-    if (pbins == NULL || pcnts == NULL) {
-        printf("[FilT-slice] ERROR, pbins and pcnts allocation failed.\n");
-        err = errno;
-        return err;
+    for (; i < n; i ++) {
+        s0 += a[i] * b[i];
     }
-    // Initalizing hist
-    printf("[FilT-slice] Binning ... ");
-    for (u64 i = 0; i < nbin; i ++) {
-        pbins[i] = tmin + i * width;
-        pcnts[i] = 0;
+    return (s0 + s1) + (s2 + s3);
+}
+
+static void
+em_fwd_task(void *arg, int ithread, u64 i0, u64 i1) {
+    em_task_t *et = (em_task_t *)arg;
+    u64 n = et->nbin;
+
+    for (u64 im = i0; im < i1; im ++) {
+        u64 lo = et->lo[im];
+        double s = em_dot(et->a + im * n + lo, et->x + lo, im - lo + 1);
+        et->sim[im] = s;
+        et->ratio[im] = s > 0 ? et->tm[im] / s : 0;
     }
+}
 
-    // Counting in even bins
-    ibin = 0;   // current bin id
-    pcnts[0] = 1;
-    for (u64 i = 1; i < len; i ++) {
-        if (arr[i] == arr[i-1]) {
-            pcnts[ibin] ++;
-        } else {
-            ibin = (u64)((float)(arr[i] - tmin) / (float)width);
-            pcnts[ibin] ++;
+static void
+em_bwd_task(void *arg, int ithread, u64 i0, u64 i1) {
+    em_task_t *et = (em_task_t *)arg;
+    u64 n = et->nbin;
+
+    for (u64 ir = i0; ir < i1; ir ++) {
+        const double *col = et->at + ir * n;
+        double c;
+        if (et->colsum[ir] <= 0) {
+            continue;
         }
+        // tm >= tr, so only bins from ir on respond, and the last bin keeps
+        // whatever goes beyond the kernel.
+        c = em_dot(col + ir, et->ratio + ir, et->hi[ir] - ir + 1) + col[n-1] * et->ratio[n-1];
+        et->x[ir] *= c / et->colsum[ir];
     }
+}
 
-    // Merging for p_low
-    nc_low = (u64)((double)len * p_low) + 1;
+int
+calc_tr_em(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_t *args,
+           double *ep) {
+    u64 nbin = tmh->nbin, it;
+    double dp_min = fabs(0.01 * args->p_low), dp = 0, tot_p = 0;
+    filt_conv_t conv;
+    em_task_t et;
+    int err, nthread;
+
+    trh->nbin = nbin;
+    trh->pbin = (prob_bin_t *)malloc(nbin * sizeof(prob_bin_t));
+    if (trh->pbin == NULL) {
+        printf("[FilT-calc_tr_em] ERROR, trh->pbin allocation failed.\n");
+        return errno;
+    }
+    for (u64 i = 0; i < nbin; i ++) {
+        trh->pbin[i].t = tmh->pbin[i].t - tf_arr[0];
+        trh->pbin[i].p = 0.0;
+    }
+    err = conv_init(tmh, tf_arr, tf_len, args->width, &conv);
+    if (err) {
+        printf("[FilT-calc_tr_em] ERROR, building the convolution kernel failed.\n");
+        free(trh->pbin);
+        trh->nbin = 0;
+        trh->pbin = NULL;
+        return err;
+    }
+
+    et.nbin = nbin;
+    et.conv = &conv;
+    et.a = (double *)malloc(nbin * nbin * sizeof(double));
+    et.at = (double *)malloc(nbin * nbin * sizeof(double));
+    et.colsum = (double *)malloc(nbin * sizeof(double));
+    et.tm = (double *)malloc(nbin * sizeof(double));
+    et.x = (double *)malloc(nbin * sizeof(double));
+    et.sim = (double *)malloc(nbin * sizeof(double));
+    et.ratio = (double *)malloc(nbin * sizeof(double));
+    et.lo = (u64 *)malloc(nbin * sizeof(u64));
+    et.hi = (u64 *)malloc(nbin * sizeof(u64));
+    if (et.a == NULL || et.at == NULL || et.colsum == NULL || et.tm == NULL ||
+        et.x == NULL || et.sim == NULL || et.ratio == NULL || et.lo == NULL || et.hi == NULL) {
+        printf("[FilT-calc_tr_em] ERROR, response matrix allocation failed.\n");
+        err = errno;
+        goto EXIT;
+    }
+
+    filt_parallel_for(args->nthread, nbin, em_build_task, &et);
+    for (u64 im = 0; im < nbin; im ++) {
+        et.lo[im] = im == nbin - 1 ? 0 : im;
+    }
+    for (u64 ir = nbin - 1; ir -- > 0; ) {
+        for (u64 im = ir; im <= et.hi[ir]; im ++) {
+            et.lo[im] = ir;
+        }
+    }
+    // Starting from a flat trh, which the multiplicative update keeps positive,
+    // or from the warm start with some of the flat one mixed in.
+    for (u64 i = 0; i < nbin; i ++) {
+        double flat = 1.0 / (double)(nbin - 1);
+        et.tm[i] = tmh->pbin[i].p;
+        et.x[i] = 0;
+        if (i < nbin - 1 && et.colsum[i] > 0) {
+            et.x[i] = args->x0 == NULL ? flat :
+                      (1 - FILT_WARM_FLOOR) * args->x0[i] + FILT_WARM_FLOOR * flat;
+        }
+    }
+
+    // Threads are spawned twice an iteration, which costs more than a small matrix.
+    nthread = nbin * nbin < (1UL << 18) ? 1 : args->nthread;
+    FILT_LOG(FILT_LOG_INFO, "[FilT-calc_tr_em] nbin=%lu, niter=%lu, nthread=%d\n", nbin, args->niter, nthread);
+    for (it = 0; it < args->niter; it ++) {
+        filt_parallel_for(nthread, nbin, em_fwd_task, &et);
+        dp = 0;
+        for (u64 im = 0; im < nbin - 1; im ++) {
+            double d = fabs(et.sim[im] - et.tm[im]);
+            dp = d > dp ? d : dp;
+        }
+        if (dp <= dp_min) {
+            break;
+        }
+        if (args->x0 != NULL) {
+            memcpy(et.sim, et.x, nbin * sizeof(double));
+        }
+        filt_parallel_for(nthread, nbin, em_bwd_task, &et);
+        // A warm start is close to the fixed point, stopping once trh stalls.
+        if (args->x0 != NULL) {
+            double dx = 0;
+            for (u64 ir = 0; ir < nbin; ir ++) {
+                double d = fabs(et.x[ir] - et.sim[ir]);
+                dx = d > dx ? d : dx;
+            }
+            if (dx <= dp_min) {
+                it ++;
+                break;
+            }
+        }
+    }
+    FILT_LOG(FILT_LOG_INFO, "[FilT-calc_tr_em] %lu iterations, max |delta_p|=%f\n", it, dp);
+
+    for (u64 i = 0; i < nbin; i ++) {
+        trh->pbin[i].p = et.x[i];
+        tot_p += et.x[i];
+    }
+    *ep = fabs(tot_p - 1);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-calc_tr_em] tot_p=%f, Normalizing probabilities...", tot_p);
+    for (u64 i = 0; i < nbin; i ++) {
+        trh->pbin[i].p /= tot_p;
+    }
+    FILT_LOG(FILT_LOG_INFO, "Done.\n");
+    fflush(stdout);
+
+EXIT:
+    free(et.a);
+    free(et.at);
+    free(et.colsum);
+    free(et.tm);
+    free(et.x);
+    free(et.sim);
+    free(et.ratio);
+    free(et.lo);
+    free(et.hi);
+    conv_free(&conv);
+    if (err) {
+        free(trh->pbin);
+        trh->nbin = 0;
+        trh->pbin = NULL;
+    }
+    return err;
+}
+
+static int
+slice_merge(i64 t0, i64 width, u64 *pcnts, u64 nbin, u64 len, double p_low, prob_hist_t *phist);
+
+int
+slice(i64 *arr, u64 len, double p_low, i64 width, prob_hist_t *phist){
+    int err = 0;
+    i64 tmin, tmax; // The max and min in arr.
+    u64 nbin;       // init bin count
+    u64 *pcnts;    // Point counts of each bin.
+
+    // For a phist = [[t0, p0], [t1, p1], ..., [t(n-1), p(n-1)]], it means for a
+    // random measurement result t, the probability t in [t0, t1) is p0.
+    // For any p in phist, p >= p_low except for p(n-1)≡0
+    // t[i] - t[i-1] is always a positive multiple to width
+    // arr does not need to be sorted.
+
+    // Counting
+    tmin = arr[0];
+    tmax = arr[0];
+    for (u64 i = 1; i < len; i ++) {
+        tmin = arr[i] < tmin ? arr[i] : tmin;
+        tmax = arr[i] > tmax ? arr[i] : tmax;
+    }
+
+    // Cells of width cover [tmin, tmax], plus the empty right edge.
+    nbin = (u64)((tmax - tmin) / width) + 2;
+    FILT_LOG(FILT_LOG_INFO, "[FilT-slice] nbin=%lu, tmin=%ld, tmax=%ld \n", nbin, tmin, tmax);
+
+    // Corner case, all points in one bin
+    if (nbin <= 2) {
+        phist->nbin = nbin;
+        phist->pbin = (prob_bin_t *)malloc(nbin * sizeof(prob_bin_t));
+        if (phist->pbin == NULL) {
+            printf("[FilT-slice] ERROR, phist->pbin allocation failed.\n");
+            err = errno;
+            return err;
+        }
+		phist->pbin[nbin-1].t = tmax + 1;
+        phist->pbin[nbin-1].p = 0;
+        phist->pbin[0].t = tmin;
+        phist->pbin[0].p = 1.0;
+
+		return err;
+    }
+    
+    pcnts = (u64 *)calloc(nbin, sizeof(u64));
+    if (pcnts == NULL) {
+        printf("[FilT-slice] ERROR, pcnts allocation failed.\n");
+        return errno;
+    }
+    // Counting in even bins, in one pass over the unsorted array
+    FILT_LOG(FILT_LOG_INFO, "[FilT-slice] Binning ... ");
+    for (u64 i = 0; i < len; i ++) {
+        pcnts[(u64)((arr[i] - tmin) / width)] ++;
+    }
+
+    err = slice_merge(tmin, width, pcnts, nbin, len, p_low, phist);
+    free(pcnts);
+
+    return err;
+}
+
+static int
+slice_merge(i64 t0, i64 width, u64 *pcnts, u64 nbin, u64 len, double p_low, prob_hist_t *phist) {
+    int err = 0;
+    u64 nc_low, nbv, nc; // lowest point count, valid nbin
+    i64 *pbins;     // Left edge of each bin.
+
+    pbins = (i64 *)malloc(nbin * sizeof(i64));
+    if (pbins == NULL) {
+        printf("[FilT-slice] ERROR, pbins allocation failed.\n");
+        return errno;
+    }
+    for (u64 i = 0; i < nbin; i ++) {
+        pbins[i] = t0 + (i64)i * width;
+    }
+
+    // Merging for p_low
+    nc_low = (u64)((double)len * p_low) + 1;
     nbv = 0;
     nc = 0;
 	// The last bin is always empty, only for marking the right edge of the histo.
@@ -380,7 +1137,11 @@ slice(i64 *arr, u64 len, double p_low, i64 width, prob_hist_t *phist){
             pbins[nbv] = pbins[i+1];
         }
     }
-    pcnts[nbv-1] += nc;
+    if (nbv == 0) {
+        pcnts[nbv++] = nc;
+    } else {
+        pcnts[nbv-1] += nc;
+    }
     pbins[nbv] = pbins[nbin-1];
     pcnts[nbv] = 0;
     nbv ++;
@@ -391,241 +1152,1289 @@ slice(i64 *arr, u64 len, double p_low, i64 width, prob_hist_t *phist){
     if (phist->pbin == NULL) {
         printf("[FilT-slice] ERROR, phist->pbin allocation failed.\n");
         err = errno;
+        free(pbins);
         return err;
     }
     for (u64 i = 0; i < nbv; i ++) {
         phist->pbin[i].t = pbins[i];
         phist->pbin[i].p = (double)pcnts[i] / (double)len;
     }
-    printf("Done.\n");
-    printf("[FilT-slice] Final bin count: %llu\n", phist->nbin);
+    FILT_LOG(FILT_LOG_INFO, "Done.\n");
+    FILT_LOG(FILT_LOG_INFO, "[FilT-slice] Final bin count: %lu\n", phist->nbin);
 
     free(pbins);
+
+    return err;
+}
+
+int
+slice_chist(filt_chist_t *ch, double pcut, double p_low, prob_hist_t *phist) {
+    u64 lo = 0, hi, keep, nc = 0, nbin, *pcnts;
+    int err;
+
+    if (ch->n == 0) {
+        printf("[FilT-slice] ERROR, empty histogram.\n");
+        return EINVAL;
+    }
+    // Dropping the highest pcut, the cell on the cut keeps part of its count.
+    keep = (u64)((double)ch->n * (1.0 - pcut));
+    keep = keep < 1 ? 1 : keep;
+    while (ch->cnts[lo] == 0) {
+        lo ++;
+    }
+    for (hi = lo; hi < ch->ncell; hi ++) {
+        nc += ch->cnts[hi];
+        if (nc >= keep) {
+            break;
+        }
+    }
+    nbin = hi - lo + 2;
+    FILT_LOG(FILT_LOG_INFO, "[FilT-slice] nbin=%lu, tmin=%ld, tmax=%ld \n", nbin,
+            (ch->c0 + (i64)lo) * ch->width, (ch->c0 + (i64)hi + 1) * ch->width - 1);
+    pcnts = (u64 *)calloc(nbin, sizeof(u64));
+    if (pcnts == NULL) {
+        printf("[FilT-slice] ERROR, pcnts allocation failed.\n");
+        return errno;
+    }
+    memcpy(pcnts, ch->cnts + lo, (nbin - 1) * sizeof(u64));
+    pcnts[nbin-2] -= nc - keep;
+
+    FILT_LOG(FILT_LOG_INFO, "[FilT-slice] Binning ... ");
+    err = slice_merge((ch->c0 + (i64)lo) * ch->width, ch->width, pcnts, nbin, keep, p_low, phist);
     free(pcnts);
 
     return err;
 }
 
 void
-calc_w(i64 *tm_arr, u64 tm_len, i64 *sim_cdf, i64 *w_arr, double *wp_arr, double p_zcut) {
-    double w = 0, wm = 0;
-    int wtile = (int)((1 - p_zcut) * (double)NTILE);
-    for (size_t i = 0; i < NTILE; i ++) {
-        size_t itm = (size_t)((double)i / (double)NTILE * tm_len);
-        w_arr[i] = sim_cdf[i] - tm_arr[itm];
-        wp_arr[i] = (double)w_arr[i] / tm_arr[itm];
-    }
-    for (size_t i = 0; i < wtile; i ++) {
-        size_t itm = (size_t)((double)i / (double)NTILE * tm_len);
-        w += abs(w_arr[i]);
-        wm += tm_arr[itm];
-    }
-    w = w / (double)wtile;
-    wm = wm / (double)wtile;
-    er = w / wm;
-
-    printf(" W-Distance=%f  ", w);
-    FILE *fp=fopen("wd.out", "w");
-    fprintf(fp, "%f", w);
+calc_w(i64 *tm_arr, u64 tm_len, i64 *sim_arr, u64 sim_len, u64 ntile, i64 *sim_cdf, i64 *w_arr,
+       double *wp_arr, double p_zcut, double *wd, double *er) {
+    double w = 0, wm = 0, ucut = 1 - p_zcut, u = 0;
+    u64 i = 0, j = 0;
+
+    for (u64 it = 0; it <= ntile; it ++) {
+        u64 itm = it < ntile ? (u64)((double)it / (double)ntile * tm_len) : tm_len - 1;
+        w_arr[it] = sim_cdf[it] - tm_arr[itm];
+        wp_arr[it] = (double)w_arr[it] / tm_arr[itm];
+    }
+
+    // W1 = int_0^ucut |Ftm^-1(u) - Fsim^-1(u)| du. Both quantile functions
+    // are steps at k/tm_len and k/sim_len, so one merge over the two sorted
+    // arrays visits every piece. The steps are compared in integers.
+    while (i < tm_len && j < sim_len && u < ucut) {
+        u64 si = (i + 1) * sim_len, sj = (j + 1) * tm_len;
+        double un = (double)(si < sj ? i + 1 : j + 1) / (double)(si < sj ? tm_len : sim_len);
+        un = un < ucut ? un : ucut;
+        w += (un - u) * (double)llabs(tm_arr[i] - sim_arr[j]);
+        wm += (un - u) * (double)tm_arr[i];
+        u = un;
+        i += si <= sj;
+        j += sj <= si;
+    }
+    *wd = w / ucut;
+    *er = w / wm;
+
+    FILT_LOG(FILT_LOG_INFO, " W-Distance=%f (%.4f%%)  ", *wd, *er * 100);
 
     return;
 }
 
+// Taking the leading integer of the line at *pp as strtoll does, and moving
+// *pp to the next line. Returns 0 for a line without digits.
+static inline int
+next_line_i64(const char **pp, const char *end, i64 *v) {
+    const char *q = *pp, *eol = (const char *)memchr(q, '\n', end - q);
+    int neg = 0, ok = 0;
+    u64 u = 0;
+
+    if (eol == NULL) {
+        eol = end;
+    }
+    while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r')) {
+        q ++;
+    }
+    if (q < eol && (*q == '-' || *q == '+')) {
+        neg = *q == '-';
+        q ++;
+    }
+    while (q < eol && *q >= '0' && *q <= '9') {
+        u = u * 10 + (u64)(*q - '0');
+        q ++;
+        ok = 1;
+    }
+    *v = neg ? -(i64)u : (i64)u;
+    *pp = eol + 1;
+    return ok;
+}
+
+typedef struct Parse_Task_T {
+    const char *buf;
+    u64 *beg;               // nchunk+1 newline-aligned chunk boundaries.
+    u64 *nrow;              // Rows in each chunk, then the row offset of each chunk.
+    i64 *arr;               // NULL in the counting pass.
+} parse_task_t;
+
+static void
+parse_task(void *arg, int ithread, u64 i0, u64 i1) {
+    parse_task_t *pt = (parse_task_t *)arg;
+    (void)ithread;
+
+    for (u64 ic = i0; ic < i1; ic ++) {
+        const char *p = pt->buf + pt->beg[ic], *end = pt->buf + pt->beg[ic+1];
+        u64 irow = pt->arr == NULL ? 0 : pt->nrow[ic];
+
+        while (p < end) {
+            i64 v;
+            if (next_line_i64(&p, end, &v)) {
+                if (pt->arr != NULL) {
+                    pt->arr[irow] = v;
+                }
+                irow ++;
+            }
+        }
+        if (pt->arr == NULL) {
+            pt->nrow[ic] = irow;
+        }
+    }
+}
+
+typedef struct Copy_Task_T {
+    const unsigned char *buf;
+    i64 *arr;
+} copy_task_t;
+
+static void
+copy_le64_task(void *arg, int ithread, u64 i0, u64 i1) {
+    copy_task_t *ct = (copy_task_t *)arg;
+    (void)ithread;
+
+    for (u64 i = i0; i < i1; i ++) {
+        u64 v;
+        memcpy(&v, ct->buf + i * 8, 8);
+        ct->arr[i] = (i64)le64toh(v);
+    }
+}
+
 int
-read_csv(char *fpath, double pcut, u64 *len, i64 **arr) {
-    FILE *fp;
-    i64 fsize;
-    i64 nrow;
+read_samples(char *fpath, double pcut, int nthread, u64 *len, i64 **arr) {
+    return read_samples_prof(fpath, pcut, nthread, NULL, len, arr);
+}
+
+int
+read_samples_prof(char *fpath, double pcut, int nthread, filt_prof_t *prof, u64 *len, i64 **arr) {
+    double t0 = prof_now();
+    int fd;
+    struct stat sb;
     char *buf;
+    u64 fsize, nrow = 0;
+    size_t plen = strlen(fpath);
+    int is_bin = plen > 4 && strcmp(fpath + plen - 4, ".bin") == 0;
     int err = 0;
-    i64 i = 0;
-    i64 irow = 0, ist = 0;
 
-    printf("[FilT-parse_csv] Reading %s.\n", fpath);
-    fp = fopen(fpath, "r");
-    if (fp == NULL) {
-        printf("[FilT-parse_csv] ERROR, file does not exist at given path: %s.\n", fpath);
+    nthread = nthread < 1 ? 1 : nthread;
+    FILT_LOG(FILT_LOG_INFO, "[FilT-read_samples] Reading %s.\n", fpath);
+    fd = open(fpath, O_RDONLY);
+    if (fd < 0) {
+        printf("[FilT-read_samples] ERROR, file does not exist at given path: %s.\n", fpath);
+        return errno;
+    }
+    if (fstat(fd, &sb) != 0) {
+        err = errno;
+        printf("[FilT-read_samples] ERROR, %s is not readable.\n", fpath);
+        close(fd);
+        return err;
+    }
+    if (sb.st_size == 0) {
+        printf("[FilT-read_samples] ERROR, %s is empty.\n", fpath);
+        close(fd);
+        return EINVAL;
+    }
+    fsize = (u64)sb.st_size;
+    buf = (char *)mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        printf("[FilT-read_samples] ERROR, mmap %s failed.\n", fpath);
         return errno;
     }
-    fseek(fp, 0, SEEK_END);
-    fsize = ftell(fp);
-    rewind(fp);
+    madvise(buf, fsize, MADV_SEQUENTIAL);
+
+    if (is_bin) {
+        // Raw little-endian int64 samples.
+        copy_task_t ct;
+        if (fsize % 8 != 0) {
+            printf("[FilT-read_samples] ERROR, size of %s is not a multiple of 8 bytes, truncated?\n", fpath);
+            err = EINVAL;
+            goto EXIT;
+        }
+        nrow = fsize / 8;
+        *arr = (i64 *)malloc((nrow > 0 ? nrow : 1) * sizeof(i64));
+        if (*arr == NULL) {
+            printf("[FilT-read_samples] ERROR, data array allocation failed.\n");
+            err = errno;
+            goto EXIT;
+        }
+        ct.buf = (const unsigned char *)buf;
+        ct.arr = *arr;
+        filt_parallel_for(nthread, nrow, copy_le64_task, &ct);
+    } else {
+        // Text, one sample per line. Chunks are aligned to line starts, rows
+        // are counted per chunk, then each chunk parses straight to its offset.
+        u64 nchunk = (u64)nthread, beg[nthread + 1], nrows[nthread];
+        parse_task_t pt;
+        beg[0] = 0;
+        for (u64 ic = 1; ic < nchunk; ic ++) {
+            u64 pos = fsize * ic / nchunk;
+            const char *nl;
+            if (pos < beg[ic-1]) {
+                pos = beg[ic-1];
+            }
+            nl = (const char *)memchr(buf + pos, '\n', fsize - pos);
+            beg[ic] = nl == NULL ? fsize : (u64)(nl - buf) + 1;
+        }
+        beg[nchunk] = fsize;
+        pt.buf = buf;
+        pt.beg = beg;
+        pt.nrow = nrows;
+        pt.arr = NULL;
+        filt_parallel_for(nthread, nchunk, parse_task, &pt);
+        for (u64 ic = 0; ic < nchunk; ic ++) {
+            u64 n = nrows[ic];
+            nrows[ic] = nrow;
+            nrow += n;
+        }
+        *arr = (i64 *)malloc((nrow > 0 ? nrow : 1) * sizeof(i64));
+        if (*arr == NULL) {
+            printf("[FilT-read_samples] ERROR, data array allocation failed.\n");
+            err = errno;
+            goto EXIT;
+        }
+        pt.arr = *arr;
+        filt_parallel_for(nthread, nchunk, parse_task, &pt);
+    }
+    if (nrow == 0) {
+        printf("[FilT-read_samples] ERROR, no data point in %s.\n", fpath);
+        free(*arr);
+        *arr = NULL;
+        err = EINVAL;
+        goto EXIT;
+    }
+    prof_add(prof, FILT_PROF_READ, -1, t0);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-read_samples] %lu data points, drop the largest %f.\n", nrow, pcut);
+    t0 = prof_now();
+    *len = filt_prep_samples(*arr, nrow, pcut, nthread);
+    prof_add(prof, FILT_PROF_SORT, -1, t0);
+
+EXIT:
+    munmap(buf, fsize);
+    return err;
+}
 
-    // Allocate memory for raw file.
-    buf = (char *)malloc(fsize + 1);
-    if (buf == NULL) {
-        printf("[FilT-parse_csv] ERROR, read buffer allocation failed.\n");
-        fclose(fp);
+int
+read_samples_from(char *fpath, u64 *off, u64 *len, i64 **arr) {
+    size_t plen = strlen(fpath);
+    int is_bin = plen > 4 && strcmp(fpath + plen - 4, ".bin") == 0;
+    struct stat sb;
+    char *buf = NULL;
+    u64 nbyte, nused = 0, nrow = 0;
+    int fd, err = 0;
+
+    *len = 0;
+    *arr = NULL;
+    fd = open(fpath, O_RDONLY);
+    if (fd < 0) {
+        printf("[FilT-read_samples_from] ERROR, file does not exist at given path: %s.\n", fpath);
         return errno;
     }
+    if (fstat(fd, &sb) != 0) {
+        err = errno;
+        goto EXIT;
+    }
+    if ((u64)sb.st_size < *off) {
+        printf("[FilT-read_samples_from] WARNING, %s was truncated, following from its end.\n", fpath);
+        *off = (u64)sb.st_size;
+    }
+    nbyte = (u64)sb.st_size - *off;
+    if (nbyte == 0) {
+        goto EXIT;
+    }
+    buf = (char *)malloc(nbyte);
+    if (buf == NULL) {
+        printf("[FilT-read_samples_from] ERROR, buffer allocation failed.\n");
+        err = errno;
+        goto EXIT;
+    }
+    for (u64 pos = 0; pos < nbyte; ) {
+        ssize_t n = pread(fd, buf + pos, nbyte - pos, (off_t)(*off + pos));
+        if (n <= 0) {
+            // The file may still be growing, taking what has been read.
+            nbyte = pos;
+            break;
+        }
+        pos += (u64)n;
+    }
 
-    // Read the file content into the character array
-    fread(buf, fsize, 1, fp);
-    buf[fsize] = '\0';  // null terminator
-    fclose(fp);
+    if (is_bin) {
+        nrow = nbyte / 8;
+        nused = nrow * 8;
+        *arr = (i64 *)malloc((nrow > 0 ? nrow : 1) * sizeof(i64));
+        if (*arr == NULL) {
+            printf("[FilT-read_samples_from] ERROR, data array allocation failed.\n");
+            err = errno;
+            goto EXIT;
+        }
+        for (u64 i = 0; i < nrow; i ++) {
+            u64 v;
+            memcpy(&v, buf + i * 8, 8);
+            (*arr)[i] = (i64)le64toh(v);
+        }
+    } else {
+        // A line without its newline may still be being written.
+        const char *p = buf, *end, *nl = (const char *)memrchr(buf, '\n', nbyte);
+        u64 nline = 0;
+        if (nl == NULL) {
+            goto EXIT;
+        }
+        nused = (u64)(nl - buf) + 1;
+        end = buf + nused;
+        for (const char *q = buf; q < end && (q = memchr(q, '\n', end - q)) != NULL; q ++) {
+            nline ++;
+        }
+        *arr = (i64 *)malloc(nline * sizeof(i64));
+        if (*arr == NULL) {
+            printf("[FilT-read_samples_from] ERROR, data array allocation failed.\n");
+            err = errno;
+            goto EXIT;
+        }
+        while (p < end) {
+            i64 v;
+            if (next_line_i64(&p, end, &v)) {
+                (*arr)[nrow ++] = v;
+            }
+        }
+    }
+    *off += nused;
+    *len = nrow;
+    if (nrow == 0) {
+        free(*arr);
+        *arr = NULL;
+    }
 
-    // Counting how many rows in the file.
-    i = 0;
-    irow = 0;
-    while (buf[i]!='\0') {
-        if (buf[i] == '\n'){
-            irow ++;
+EXIT:
+    free(buf);
+    close(fd);
+    return err;
+}
+
+// Header of a tf cache, followed by len native int64 samples.
+typedef struct TFC_Header_T {
+    char magic[8];
+    u64 hash;               // Content hash of the sample file.
+    u64 fsize;
+    double pcut;
+    u64 len;
+    u64 pad[3];             // Keeping the samples 64-byte aligned.
+} tfc_header_t;
+
+static const char tfc_magic[8] = {'F', 'I', 'L', 'T', 'T', 'F', 'C', '1'};
+
+typedef struct Hash_Task_T {
+    const unsigned char *buf;
+    u64 len;
+    u64 *hash;              // One hash per TFC_HASH_CHUNK.
+} hash_task_t;
+
+#define TFC_HASH_CHUNK (1UL << 20)
+
+static inline u64
+hash_mix(u64 h, u64 w) {
+    h ^= w * 0x9e3779b97f4a7c15UL;
+    h = (h << 31) | (h >> 33);
+    return h * 0xbf58476d1ce4e5b9UL;
+}
+
+static void
+hash_task(void *arg, int ithread, u64 i0, u64 i1) {
+    hash_task_t *ht = (hash_task_t *)arg;
+
+    for (u64 ic = i0; ic < i1; ic ++) {
+        const unsigned char *p = ht->buf + ic * TFC_HASH_CHUNK;
+        u64 n = ht->len - ic * TFC_HASH_CHUNK, h = ic, w;
+        n = n < TFC_HASH_CHUNK ? n : TFC_HASH_CHUNK;
+        for (u64 i = 0; i + 8 <= n; i += 8) {
+            memcpy(&w, p + i, 8);
+            h = hash_mix(h, w);
         }
-        i ++;
+        w = 0;
+        memcpy(&w, p + n / 8 * 8, n % 8);
+        ht->hash[ic] = hash_mix(h, w ^ n);
     }
-    nrow = irow;
-    *len = (u64)((double)nrow * (1.0 - pcut));
-    printf("[FilT-parse_csv] %lld data points, drop the largest %f.\n", nrow, pcut);
+}
 
-    // Allocating memory space for raw data array.
-    *arr = (i64 *)malloc(nrow*sizeof(i64));
-    if (*arr == NULL) {
-        printf("[FilT-parse_csv] ERROR, read buffer allocation failed.\n");
-        fclose(fp);
-        err = errno;
+// Hashing fixed size chunks in parallel, so the hash is the same at any thread count.
+static int
+hash_file(char *fpath, int nthread, u64 *hash, u64 *fsize) {
+    int fd;
+    struct stat sb;
+    void *buf;
+    hash_task_t ht;
+    u64 nchunk;
+
+    fd = open(fpath, O_RDONLY);
+    if (fd < 0 || fstat(fd, &sb) != 0 || sb.st_size == 0) {
+        int err = fd < 0 ? errno : EINVAL;
+        if (fd >= 0) {
+            close(fd);
+        }
         return err;
     }
-    // Converting char to i64;
-    i = 0;
-    irow = 0;
-    ist = 0;
-    while (buf[i]!='\0') {
-        // Loop over lines.
-        if (buf[i] == '\n') {
-            buf[i] = '\0';
-            (*arr)[irow] = strtoll(&(buf[ist]), NULL, 10);
-            irow ++;
-            ist = i + 1;
+    *fsize = (u64)sb.st_size;
+    buf = mmap(NULL, *fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        return errno;
+    }
+    nchunk = (*fsize + TFC_HASH_CHUNK - 1) / TFC_HASH_CHUNK;
+    ht.buf = (const unsigned char *)buf;
+    ht.len = *fsize;
+    ht.hash = (u64 *)malloc(nchunk * sizeof(u64));
+    if (ht.hash == NULL) {
+        munmap(buf, *fsize);
+        return errno;
+    }
+    filt_parallel_for(nthread, nchunk, hash_task, &ht);
+    *hash = *fsize;
+    for (u64 ic = 0; ic < nchunk; ic ++) {
+        *hash = hash_mix(*hash, ht.hash[ic]);
+    }
+    free(ht.hash);
+    munmap(buf, *fsize);
+
+    return 0;
+}
+
+static int
+tfc_map(char *cpath, u64 hash, u64 fsize, double pcut, filt_tfc_t *tfc) {
+    int fd;
+    struct stat sb;
+    void *map;
+    tfc_header_t *hd;
+
+    fd = open(cpath, O_RDONLY);
+    if (fd < 0) {
+        return ENOENT;
+    }
+    if (fstat(fd, &sb) != 0 || (u64)sb.st_size < sizeof(tfc_header_t)) {
+        close(fd);
+        return EINVAL;
+    }
+    map = mmap(NULL, (u64)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return errno;
+    }
+    hd = (tfc_header_t *)map;
+    if (memcmp(hd->magic, tfc_magic, 8) != 0 || hd->hash != hash || hd->fsize != fsize ||
+        hd->pcut != pcut || hd->len == 0 ||
+        (u64)sb.st_size != sizeof(tfc_header_t) + hd->len * sizeof(i64)) {
+        munmap(map, (u64)sb.st_size);
+        return EINVAL;
+    }
+    tfc->map = map;
+    tfc->map_len = (u64)sb.st_size;
+    tfc->arr = (i64 *)((char *)map + sizeof(tfc_header_t));
+    tfc->len = hd->len;
+
+    return 0;
+}
+
+// Writing to a temporary file first, so a reader never maps a partial cache.
+static int
+tfc_write(char *cpath, u64 hash, u64 fsize, double pcut, filt_tfc_t *tfc) {
+    char tpath[strlen(cpath) + 32];
+    tfc_header_t hd;
+    FILE *fp;
+    int ok;
+
+    memset(&hd, 0, sizeof(hd));
+    memcpy(hd.magic, tfc_magic, 8);
+    hd.hash = hash;
+    hd.fsize = fsize;
+    hd.pcut = pcut;
+    hd.len = tfc->len;
+    sprintf(tpath, "%s.%d", cpath, (int)getpid());
+    fp = fopen(tpath, "wb");
+    if (fp == NULL) {
+        return errno;
+    }
+    ok = fwrite(&hd, sizeof(hd), 1, fp) == 1 &&
+         fwrite(tfc->arr, sizeof(i64), tfc->len, fp) == tfc->len;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tpath, cpath) != 0) {
+        unlink(tpath);
+        return EIO;
+    }
+
+    return 0;
+}
+
+int
+tfc_load(char *fpath, double pcut, int nthread, int use_cache, filt_prof_t *prof, filt_tfc_t *tfc) {
+    char cpath[strlen(fpath) + sizeof(FILT_TFC_SUFFIX)];
+    u64 hash = 0, fsize = 0;
+    double t0 = prof_now();
+    int err;
+
+    tfc->arr = NULL;
+    tfc->len = 0;
+    tfc->map = NULL;
+    tfc->map_len = 0;
+    tfc->tfd.len = 0;
+    tfc->tfd.bits = 0;
+    tfc->tfd.off = NULL;
+    if (!use_cache) {
+        err = read_samples_prof(fpath, pcut, nthread, prof, &tfc->len, &tfc->arr);
+        if (err == 0) {
+            tfd_init(&tfc->tfd, tfc->arr, tfc->len);
         }
-        i ++;
+        return err;
+    }
+
+    sprintf(cpath, "%s%s", fpath, FILT_TFC_SUFFIX);
+    err = hash_file(fpath, nthread < 1 ? 1 : nthread, &hash, &fsize);
+    if (err) {
+        printf("[FilT-tfc_load] ERROR, cannot hash %s.\n", fpath);
+        return err;
+    }
+    if (tfc_map(cpath, hash, fsize, pcut, tfc) == 0) {
+        prof_add(prof, FILT_PROF_READ, -1, t0);
+        FILT_LOG(FILT_LOG_INFO, "[FilT-tfc_load] Mapped %lu samples from cache %s.\n", tfc->len, cpath);
+        tfd_init(&tfc->tfd, tfc->arr, tfc->len);
+        return 0;
+    }
+
+    prof_add(prof, FILT_PROF_READ, -1, t0);
+    err = read_samples_prof(fpath, pcut, nthread, prof, &tfc->len, &tfc->arr);
+    if (err) {
+        return err;
     }
-    qsort(*arr, nrow, sizeof(i64), cmp);
+    if (tfc_write(cpath, hash, fsize, pcut, tfc) == 0) {
+        FILT_LOG(FILT_LOG_INFO, "[FilT-tfc_load] Wrote cache %s.\n", cpath);
+    } else {
+        printf("[FilT-tfc_load] WARNING, cannot write cache %s.\n", cpath);
+    }
+    tfd_init(&tfc->tfd, tfc->arr, tfc->len);
 
     return 0;
 }
 
+void
+tfc_free(filt_tfc_t *tfc) {
+    tfd_free(&tfc->tfd);
+    if (tfc->map != NULL) {
+        munmap(tfc->map, tfc->map_len);
+    } else {
+        free(tfc->arr);
+    }
+    tfc->arr = NULL;
+    tfc->map = NULL;
+}
+
 int
-run_filt(filt_param_t *args, prob_hist_t *tr_hist, i64 *sim_cdf, 
-            i64 *w_arr, double *wp_arr){
-    u64 tm_len, tf_len;
+read_csv(char *fpath, double pcut, u64 *len, i64 **arr) {
+    return read_samples(fpath, pcut, 1, len, arr);
+}
+
+typedef struct Summary_Task_T {
+    const char *buf;
+    u64 *beg;               // nthread+1 chunk boundaries of the block.
+    int is_bin;
+    filt_kll_t *kll;        // One sketch per thread.
+    filt_chist_t *ch;       // One histogram per thread, NULL if not needed.
+    int *err;
+} summary_task_t;
+
+static void
+summary_task(void *arg, int ithread, u64 i0, u64 i1) {
+    summary_task_t *st = (summary_task_t *)arg;
+
+    for (u64 ic = i0; ic < i1; ic ++) {
+        const char *p = st->buf + st->beg[ic], *end = st->buf + st->beg[ic+1];
+        int err = 0;
+        while (p < end && err == 0) {
+            i64 v;
+            if (st->is_bin) {
+                u64 u;
+                memcpy(&u, p, 8);
+                v = (i64)le64toh(u);
+                p += 8;
+            } else if (!next_line_i64(&p, end, &v)) {
+                continue;
+            }
+            err = kll_update(&st->kll[ithread], v);
+            if (err == 0 && st->ch != NULL) {
+                err = chist_add(&st->ch[ithread], v);
+            }
+        }
+        if (err) {
+            st->err[ithread] = err;
+        }
+    }
+}
+
+int
+read_summary(char *fpath, int nthread, i64 width, u64 k, u64 seed,
+             filt_chist_t *ch, filt_kll_t *kll) {
+    int fd;
+    char *buf;
+    u64 ncarry = 0, nread = 0;
+    size_t plen = strlen(fpath);
+    int is_bin = plen > 4 && strcmp(fpath + plen - 4, ".bin") == 0;
+    int err = 0, eof = 0;
+
+    nthread = nthread < 1 ? 1 : nthread;
+    filt_kll_t kll_t[nthread];
+    filt_chist_t ch_t[nthread];
+    int err_t[nthread];
+    u64 beg[nthread + 1];
+    summary_task_t st;
+
+    FILT_LOG(FILT_LOG_INFO, "[FilT-read_summary] Streaming %s.\n", fpath);
+    fd = open(fpath, O_RDONLY);
+    if (fd < 0) {
+        printf("[FilT-read_summary] ERROR, file does not exist at given path: %s.\n", fpath);
+        return errno;
+    }
+    buf = (char *)malloc(FILT_STREAM_BLOCK);
+    if (buf == NULL) {
+        printf("[FilT-read_summary] ERROR, block buffer allocation failed.\n");
+        close(fd);
+        return errno;
+    }
+    for (int t = 0; t < nthread; t ++) {
+        kll_init(&kll_t[t], k, seed + (u64)t);
+        chist_init(&ch_t[t], width);
+        err_t[t] = 0;
+    }
+    st.buf = buf;
+    st.beg = beg;
+    st.is_bin = is_bin;
+    st.kll = kll_t;
+    st.ch = ch == NULL ? NULL : ch_t;
+    st.err = err_t;
+
+    // Reading blocks of bounded size. The tail after the last full line (or
+    // int64) of a block is carried to the next one.
+    while (!eof && err == 0) {
+        ssize_t nr = read(fd, buf + ncarry, FILT_STREAM_BLOCK - ncarry);
+        u64 nbuf, nuse;
+        if (nr < 0) {
+            printf("[FilT-read_summary] ERROR, reading %s failed.\n", fpath);
+            err = errno;
+            break;
+        }
+        eof = nr == 0;
+        nread += (u64)nr;
+        nbuf = ncarry + (u64)nr;
+        if (is_bin) {
+            nuse = nbuf / 8 * 8;
+        } else if (eof) {
+            nuse = nbuf;
+        } else {
+            const char *nl = (const char *)memrchr(buf, '\n', nbuf);
+            nuse = nl == NULL ? nbuf : (u64)(nl - buf) + 1;
+        }
+        beg[0] = 0;
+        for (int t = 1; t < nthread; t ++) {
+            u64 pos = nuse * t / nthread;
+            if (is_bin) {
+                pos = pos / 8 * 8;
+            } else {
+                const char *nl = (const char *)memchr(buf + pos, '\n', nuse - pos);
+                pos = nl == NULL ? nuse : (u64)(nl - buf) + 1;
+            }
+            beg[t] = pos < beg[t-1] ? beg[t-1] : pos;
+        }
+        beg[nthread] = nuse;
+        filt_parallel_for(nthread, nthread, summary_task, &st);
+        for (int t = 0; t < nthread; t ++) {
+            err = err ? err : err_t[t];
+        }
+        ncarry = nbuf - nuse;
+        memmove(buf, buf + nuse, ncarry);
+    }
+    close(fd);
+    free(buf);
+    if (err == 0 && is_bin && ncarry != 0) {
+        printf("[FilT-read_summary] ERROR, size of %s is not a multiple of 8 bytes, truncated?\n", fpath);
+        err = EINVAL;
+    }
+
+    // Merging the per-thread summaries.
+    *kll = kll_t[0];
+    if (ch != NULL) {
+        *ch = ch_t[0];
+    } else {
+        chist_free(&ch_t[0]);
+    }
+    for (int t = 1; t < nthread; t ++) {
+        if (err == 0) {
+            err = kll_merge(kll, &kll_t[t]);
+        }
+        if (err == 0 && ch != NULL) {
+            err = chist_merge(ch, &ch_t[t]);
+        }
+        kll_free(&kll_t[t]);
+        chist_free(&ch_t[t]);
+    }
+    if (err == 0 && kll->n == 0) {
+        printf("[FilT-read_summary] ERROR, no data point in %s.\n", fpath);
+        err = EINVAL;
+    }
+    if (err) {
+        kll_free(kll);
+        if (ch != NULL) {
+            chist_free(ch);
+        }
+        return err;
+    }
+    FILT_LOG(FILT_LOG_INFO, "[FilT-read_summary] %lu data points in %lu bytes, min=%ld, max=%ld.\n",
+            kll->n, nread, kll->min, kll->max);
+
+    return 0;
+}
+
+u64
+filt_prep_samples(i64 *arr, u64 n, double pcut, int nthread) {
+    sort_i64(arr, n, nthread);
+    return (u64)((double)n * (1.0 - pcut));
+}
+
+void
+filt_param_init(filt_param_t *args) {
+    struct timeval tv;
+
+    args->in_tm_file = "met.csv";
+    args->in_tf_file = "tf.csv";
+    args->out_trh_file = "tr_hist.csv";
+    args->out_sim_file = "sim_cdf.csv";
+    args->batch_file = NULL;
+    args->width = 100;
+    args->nsamp = 1000000;
+    args->p_low = 0.001;
+    args->p_xcut = 0.0;
+    args->p_ycut = 0.0;
+    args->p_zcut = 0.0;
+    args->sketch_k = 0;
+    args->solver = FILT_SOLVER_SWEEP;
+    args->niter = 1000;
+    args->adaptive = 0;
+    args->tf_cache = 0;
+    args->ntile = NTILE;
+    args->nboot = 0;
+    args->prof = NULL;
+    args->x0 = NULL;
+    args->tfd = NULL;
+    args->nthread = 1;
+    args->njob = 1;
+    args->mode = FILT_MODE_MC;
+    gettimeofday(&tv, NULL);
+    args->seed = tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void
+filt_result_free(filt_result_t *res) {
+    free(res->tr_hist.pbin);
+    free(res->sim_cdf);
+    free(res->w_arr);
+    free(res->wp_arr);
+    res->tr_hist.pbin = NULL;
+    res->tr_hist.nbin = 0;
+    res->sim_cdf = NULL;
+    res->w_arr = NULL;
+    res->wp_arr = NULL;
+    free(res->p_lo);
+    free(res->p_hi);
+    res->p_lo = NULL;
+    res->p_hi = NULL;
+    res->nboot = 0;
+}
+
+typedef struct Boot_Task_T {
+    filt_param_t *args;
+    prob_hist_t *tmh;
     i64 *tm_arr, *tf_arr;
+    u64 tm_len, tf_len;
+    double *ps;             // nboot x nbin probabilities of the replicates.
+    int *err;               // Per replicate.
+} boot_task_t;
+
+// Drawing n samples of arr with replacement and sorting them.
+static void
+boot_resample(i64 *arr, u64 n, u64 seed, u64 stream, i64 *out) {
+    for (u64 i = 0; i < n; i ++) {
+        double u[2];
+        filt_rng_u01(seed, stream, i, u);
+        out[i] = arr[(u64)(u[0] * (double)n)];
+    }
+    sort_i64(out, n, 1);
+}
+
+static void
+boot_task(void *arg, int ithread, u64 i0, u64 i1) {
+    boot_task_t *bt = (boot_task_t *)arg;
+    u64 nbin = bt->tmh->nbin;
+    i64 *tm_b = (i64 *)malloc(bt->tm_len * sizeof(i64));
+    i64 *tf_b = (i64 *)malloc(bt->tf_len * sizeof(i64));
+    prob_bin_t *pbin = (prob_bin_t *)malloc(nbin * sizeof(prob_bin_t));
+
+    for (u64 b = i0; b < i1; b ++) {
+        filt_param_t args = *bt->args;
+        prob_hist_t tmh_b, trh_b;
+        filt_mc_t mc;
+        u64 ib = 0, base = (b + 1) << 32;
+        double ep;
+
+        if (tm_b == NULL || tf_b == NULL || pbin == NULL) {
+            bt->err[b] = ENOMEM;
+            continue;
+        }
+        // Replicate b owns the streams [base, base + 2^32).
+        boot_resample(bt->tm_arr, bt->tm_len, args.seed, base, tm_b);
+        boot_resample(bt->tf_arr, bt->tf_len, args.seed, base + 1, tf_b);
+        // Keeping the smallest tf, so trh of every replicate has the same edges.
+        tf_b[0] = bt->tf_arr[0];
+
+        // Binning on the edges of tmh, the sorted tm_b is walked once.
+        for (u64 i = 0; i < nbin; i ++) {
+            pbin[i].t = bt->tmh->pbin[i].t;
+            pbin[i].p = 0;
+        }
+        for (u64 i = 0; i < bt->tm_len; i ++) {
+            while (ib + 2 < nbin && tm_b[i] >= pbin[ib+1].t) {
+                ib ++;
+            }
+            pbin[ib].p += 1.0 / (double)bt->tm_len;
+        }
+        tmh_b.nbin = nbin;
+        tmh_b.pbin = pbin;
+
+        // Replicates are timed as a whole by the caller.
+        args.nthread = 1;
+        args.prof = NULL;
+        mc.seed = args.seed;
+        mc.stream = base + 2;
+        mc.nthread = 1;
+        mc.tfd = NULL;
+        bt->err[b] = calc_tr(&tmh_b, &trh_b, tf_b, bt->tf_len, &args, &mc, &ep);
+        if (bt->err[b] == 0) {
+            for (u64 i = 0; i < nbin; i ++) {
+                bt->ps[b * nbin + i] = trh_b.pbin[i].p;
+            }
+        }
+        free(trh_b.pbin);
+    }
+    free(tm_b);
+    free(tf_b);
+    free(pbin);
+}
+
+static int
+cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int
+filt_bootstrap(filt_param_t *args, prob_hist_t *tmh, i64 *tm_arr, u64 tm_len,
+               i64 *tf_arr, u64 tf_len, double *p_lo, double *p_hi) {
+    u64 nbin = tmh->nbin, nboot = args->nboot;
+    double alpha = (1 - FILT_BOOT_LEVEL) / 2, *col;
+    boot_task_t bt;
+    int err = 0;
+
+    FILT_LOG(FILT_LOG_INFO, "[FilT-filt_bootstrap] %lu replicates on %d threads.\n", nboot, args->nthread);
+    bt.args = args;
+    bt.tmh = tmh;
+    bt.tm_arr = tm_arr;
+    bt.tm_len = tm_len;
+    bt.tf_arr = tf_arr;
+    bt.tf_len = tf_len;
+    bt.ps = (double *)malloc(nboot * nbin * sizeof(double));
+    bt.err = (int *)calloc(nboot, sizeof(int));
+    col = (double *)malloc(nboot * sizeof(double));
+    if (bt.ps == NULL || bt.err == NULL || col == NULL) {
+        printf("[FilT-filt_bootstrap] ERROR, replicate allocation failed.\n");
+        err = errno;
+        goto EXIT;
+    }
+    // Every thread takes a contiguous range of whole replicates.
+    filt_parallel_for(args->nthread, nboot, boot_task, &bt);
+    for (u64 b = 0; b < nboot && err == 0; b ++) {
+        err = bt.err[b];
+    }
+    if (err) {
+        printf("[FilT-filt_bootstrap] ERROR, a replicate failed. ERRCODE %d\n", err);
+        goto EXIT;
+    }
+
+    // Percentile intervals of each bin.
+    for (u64 i = 0; i < nbin; i ++) {
+        for (u64 b = 0; b < nboot; b ++) {
+            col[b] = bt.ps[b * nbin + i];
+        }
+        qsort(col, nboot, sizeof(double), cmp_double);
+        p_lo[i] = col[(u64)(alpha * (double)(nboot - 1) + 0.5)];
+        p_hi[i] = col[(u64)((1 - alpha) * (double)(nboot - 1) + 0.5)];
+    }
+
+EXIT:
+    free(bt.ps);
+    free(bt.err);
+    free(col);
+    return err;
+}
+
+int
+filt_run(filt_param_t *args, i64 *tm_arr, u64 tm_len, i64 *tf_arr, u64 tf_len,
+         filt_result_t *res){
     prob_hist_t tm_hist;
+    double t0 = prof_now();
     int err;
 
-    // Parsing csv files and slicing specified column into histogram, saving to pmet_hist and ptf_hist
-    // malloc inside slice function
-    printf("[FilT-run_filt] Parsing measurement file %s\n", args->in_tm_file);
-    err = read_csv(args->in_tm_file, args->p_xcut, &tm_len, &tm_arr);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-filt_run] Slicing measurement array.\n");
+    err = slice(tm_arr, tm_len, args->p_low, args->width, &tm_hist);
+    prof_add(args->prof, FILT_PROF_SLICE, -1, t0);
     if (err) {
-        printf("[FilT-run_filt] Error in reading measurement csv file. ERRCODE %d\n", err);
+        printf("[FilT-filt_run] Error in slicing met array. ERRCODE %d\n", err);
         return err;
     }
+    err = filt_run_hist(args, &tm_hist, tm_arr, tm_len, tf_arr, tf_len, res);
 
-    printf("[FilT-run_filt] Slicing measurement file %s\n", args->in_tm_file);
-    err = slice(tm_arr, tm_len, args->p_low, args->width, &tm_hist);
-    if (err) {
-        printf("[FilT-run_filt] Error in slicing met array. ERRCODE %d\n", err);
+    free(tm_hist.pbin);
+    return err;
+}
+
+int
+filt_run_hist(filt_param_t *args, prob_hist_t *tmh, i64 *tm_arr, u64 tm_len,
+              i64 *tf_arr, u64 tf_len, filt_result_t *res){
+    filt_mc_t mc;
+    filt_tfd_t tfd;
+    i64 *sim_arr;
+    double t0;
+    int err;
+
+    mc.seed = args->seed;
+    mc.stream = 0;
+    mc.nthread = args->nthread;
+    mc.tfd = NULL;
+
+    res->tr_hist.nbin = 0;
+    res->tr_hist.pbin = NULL;
+    res->nboot = 0;
+    res->p_lo = NULL;
+    res->p_hi = NULL;
+    res->ntile = args->ntile;
+    res->sim_cdf = (i64 *)malloc((res->ntile + 1) * sizeof(i64));
+    res->w_arr = (i64 *)malloc((res->ntile + 1) * sizeof(i64));
+    res->wp_arr = (double *)malloc((res->ntile + 1) * sizeof(double));
+    if (res->sim_cdf == NULL || res->w_arr == NULL || res->wp_arr == NULL) {
+        printf("[FilT-filt_run] ERROR, result allocation failed.\n");
+        err = errno;
+        filt_result_free(res);
         return err;
     }
+
     // Print measured hist for debugging.
-    printf("[FilT-run_filt] Histogram of measured run times:\ntime\t\tp\n");
-    for (size_t i = 0; i < tm_hist.nbin - 1; i ++) {
-        printf("[%ld, %ld)\t%.7f\n", 
-                tm_hist.pbin[i].t, tm_hist.pbin[i+1].t, tm_hist.pbin[i].p);
+    FILT_LOG(FILT_LOG_DEBUG, "[FilT-filt_run] Histogram of measured run times:\ntime\t\tp\n");
+    for (size_t i = 0; i < tmh->nbin - 1; i ++) {
+        FILT_LOG(FILT_LOG_DEBUG, "[%ld, %ld)\t%.7f\n", 
+                tmh->pbin[i].t, tmh->pbin[i+1].t, tmh->pbin[i].p);
     }
 
-    printf("[FilT-run_filt] Parsing timing fluctuation file %s\n", args->in_tf_file);
-    err = read_csv(args->in_tf_file, args->p_ycut, &tf_len, &tf_arr);
+    // The simulations draw tf from a compact copy, the caller's if it is of
+    // tf_arr, and fall back to tf_arr if none can be built.
+    tfd.off = NULL;
+    if (args->tfd != NULL && args->tfd->len == tf_len && args->tfd->base == tf_arr[0]) {
+        mc.tfd = args->tfd;
+    } else if (tfd_init(&tfd, tf_arr, tf_len) == 0) {
+        mc.tfd = &tfd;
+    }
+
+    FILT_LOG(FILT_LOG_INFO, "[FilT-filt_run] Start estimating real run time distribution.\n");
+    err = calc_tr(tmh, &res->tr_hist, tf_arr, tf_len, args, &mc, &res->ep);
     if (err) {
-        printf("[FilT-run_filt] Error in parsing timing fluctuations csv file. ERRCODE %d\n", err);
+        printf("[FilT-filt_run] Error in transposed convolution. ERRCODE %d\n", err);
+        tfd_free(&tfd);
+        filt_result_free(res);
         return err;
     }
 
-    printf("[FilT-run_filt] Start estimating real run time distribution.\n");
-    err = calc_tr(&tm_hist, tr_hist, tf_arr, tf_len, args);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-filt_run] Verifying the estimation...");
+    t0 = prof_now();
+    err = sim_verify(tmh, &res->tr_hist, tf_arr, tf_len, res->ntile, res->sim_cdf, args->nsamp,
+                     &mc, &sim_arr);
+    prof_add(args->prof, FILT_PROF_SIM_VERIFY, -1, t0);
+    tfd_free(&tfd);
     if (err) {
-        printf("[FilT-run_filt] Error in transposed convolution. ERRCODE %d\n", err);
+        printf("[FilT-filt_run] Error in verification. ERRCODE %d\n", err);
+        filt_result_free(res);
         return err;
     }
+    t0 = prof_now();
+    calc_w(tm_arr, tm_len, sim_arr, args->nsamp, res->ntile, res->sim_cdf, res->w_arr, res->wp_arr,
+           args->p_zcut, &res->wd, &res->er);
+    prof_add(args->prof, FILT_PROF_CALC_W, -1, t0);
+    free(sim_arr);
+    FILT_LOG(FILT_LOG_INFO, "Done.\n");
 
-    printf("[FilT-run_filt] Verifying the estimation...");
-    sim_verify(&tm_hist, tr_hist, tf_arr, tf_len, sim_cdf, args->nsamp);
-    calc_w(tm_arr, tm_len, sim_cdf, w_arr, wp_arr, args->p_zcut);
-    printf("Done.\n");
+    if (args->nboot > 0) {
+        res->p_lo = (double *)malloc(tmh->nbin * sizeof(double));
+        res->p_hi = (double *)malloc(tmh->nbin * sizeof(double));
+        if (res->p_lo == NULL || res->p_hi == NULL) {
+            printf("[FilT-filt_run] ERROR, confidence interval allocation failed.\n");
+            err = errno;
+            filt_result_free(res);
+            return err;
+        }
+        t0 = prof_now();
+        err = filt_bootstrap(args, tmh, tm_arr, tm_len, tf_arr, tf_len, res->p_lo, res->p_hi);
+        prof_add(args->prof, FILT_PROF_BOOTSTRAP, -1, t0);
+        if (err) {
+            printf("[FilT-filt_run] Error in bootstrap. ERRCODE %d\n", err);
+            filt_result_free(res);
+            return err;
+        }
+        res->nboot = args->nboot;
+    }
 
-    free(tm_arr);
-    free(tf_arr);
-    free(tm_hist.pbin);
     return 0;
 }
 
-//int
-//arg_parse(int argc, char **argv){
-//
-//}
+int
+run_filt(filt_param_t *args, filt_result_t *res){
+    filt_param_t rargs;
+    u64 tm_len;
+    i64 *tm_arr;
+    filt_tfc_t tfc;
+    int err;
 
-/*=== END: Implementations ===*/
+    // Parsing csv files and slicing specified column into histogram, saving to pmet_hist and ptf_hist
+    // malloc inside slice function
+    FILT_LOG(FILT_LOG_INFO, "[FilT-run_filt] Parsing measurement file %s\n", args->in_tm_file);
+    err = read_samples_prof(args->in_tm_file, args->p_xcut, args->nthread, args->prof, &tm_len, &tm_arr);
+    if (err) {
+        printf("[FilT-run_filt] Error in reading measurement csv file. ERRCODE %d\n", err);
+        return err;
+    }
 
-/*=== BEGIN: Main Entry ===*/
+    FILT_LOG(FILT_LOG_INFO, "[FilT-run_filt] Parsing timing fluctuation file %s\n", args->in_tf_file);
+    err = tfc_load(args->in_tf_file, args->p_ycut, args->nthread, args->tf_cache, args->prof, &tfc);
+    if (err) {
+        printf("[FilT-run_filt] Error in parsing timing fluctuations csv file. ERRCODE %d\n", err);
+        free(tm_arr);
+        return err;
+    }
+
+    rargs = *args;
+    rargs.tfd = &tfc.tfd;
+    err = filt_run(&rargs, tm_arr, tm_len, tfc.arr, tfc.len, res);
+
+    free(tm_arr);
+    tfc_free(&tfc);
+    return err;
+}
 
 int
-main(int argc, char **argv){
-    filt_param_t args;
-    prob_hist_t tr_hist;
+run_filt_sketch(filt_param_t *args, filt_result_t *res){
+    filt_kll_t tm_kll, tf_kll;
+    filt_chist_t tm_ch;
+    prob_hist_t tm_hist;
+    i64 *tm_q = NULL, *tf_q = NULL;
+    double t0 = prof_now();
     int err;
-    i64 sim_cdf[NTILE+1], w_arr[NTILE+1];
-    double wp_arr[NTILE+1];
-    
-    args.in_tm_file = "met.csv";
-    args.in_tf_file = "tf.csv";
-    args.out_trh_file = "tr_hist.csv";
-    args.out_sim_file = "sim_cdf.csv";
-    args.width = 100;
-    args.nsamp = 1000000;
-    args.p_low = 0.001;
-    args.p_xcut = 0.0;
-    args.p_ycut = 0.0;
-
-    // Parse command line
-    argp_parse(&argp, argc, argv, 0, 0, &args);
-
-    printf("[FilT-main] Met in file: %s\n", args.in_tm_file);
-    printf("[FilT-main] Timing fluctuation file: %s\n", args.in_tf_file);
-    printf("[FilT-main] p_low=%f, width=%llu, nsamp=%llu, "
-            "met_cut=%f, tf_cut=%f\n", 
-            args.p_low, args.width, args.nsamp, args.p_xcut, args.p_ycut);
-
-    // Reading input files and estimating the real run time distribution.
-    err = run_filt(&args, &tr_hist, sim_cdf, w_arr, wp_arr);
 
-    if (err == 0) {
-        printf("[FilT-main] Writing results to %s...", args.out_trh_file);
-        FILE *fp = fopen(args.out_trh_file, "w");
-        for (i64 i = 0; i < tr_hist.nbin; i ++) {
-            fprintf(fp, "%lld, %lf\n", tr_hist.pbin[i].t, tr_hist.pbin[i].p);
-        }
-        fclose(fp);
-        free(tr_hist.pbin);
-        printf("Done.\n");
-        printf("[FilT-main] Writing verification simulation results to %s...", args.out_sim_file);
-        fp = fopen(args.out_sim_file, "w");
-        for (int i = 0; i < NTILE+1; i ++) {
-            fprintf(fp, "%d, %ld, %ld, %lf\n", i, sim_cdf[i], w_arr[i], wp_arr[i]);
-        }
-        fclose(fp);
-        fp = fopen("er.out", "w");
-        fprintf(fp, "%f", er);
-        fclose(fp);
-        fp = fopen("ep.out", "w");
-        fprintf(fp, "%f", ep);
-        fclose(fp);
-        printf("Done. er=%f, ep=%f\n", er, ep);
-    } else {
-        printf("[FilT-main] run_filt returned with errors. ERRCODE %d\n", err);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-run_filt_sketch] Summarizing measurement file %s\n", args->in_tm_file);
+    err = read_summary(args->in_tm_file, args->nthread, args->width, args->sketch_k, args->seed,
+                       &tm_ch, &tm_kll);
+    if (err) {
+        printf("[FilT-run_filt_sketch] Error in reading measurement file. ERRCODE %d\n", err);
+        return err;
+    }
+    FILT_LOG(FILT_LOG_INFO, "[FilT-run_filt_sketch] Summarizing timing fluctuation file %s\n", args->in_tf_file);
+    err = read_summary(args->in_tf_file, args->nthread, args->width, args->sketch_k, args->seed,
+                       NULL, &tf_kll);
+    if (err) {
+        printf("[FilT-run_filt_sketch] Error in reading timing fluctuation file. ERRCODE %d\n", err);
+        kll_free(&tm_kll);
+        chist_free(&tm_ch);
         return err;
     }
+    prof_add(args->prof, FILT_PROF_READ, -1, t0);
+
+    // tmh comes from the exact histogram, the sorted arrays of calc_w and
+    // calc_tr are replaced by FILT_SKETCH_NQ evenly spaced quantiles.
+    t0 = prof_now();
+    err = slice_chist(&tm_ch, args->p_xcut, args->p_low, &tm_hist);
+    prof_add(args->prof, FILT_PROF_SLICE, -1, t0);
+    chist_free(&tm_ch);
+    if (err == 0) {
+        tm_q = (i64 *)malloc(FILT_SKETCH_NQ * sizeof(i64));
+        tf_q = (i64 *)malloc(FILT_SKETCH_NQ * sizeof(i64));
+        if (tm_q == NULL || tf_q == NULL) {
+            printf("[FilT-run_filt_sketch] ERROR, quantile array allocation failed.\n");
+            err = errno;
+        }
+        if (err == 0) {
+            err = kll_quantiles(&tm_kll, FILT_SKETCH_NQ, args->p_xcut, tm_q);
+        }
+        if (err == 0) {
+            err = kll_quantiles(&tf_kll, FILT_SKETCH_NQ, args->p_ycut, tf_q);
+        }
+        if (err == 0) {
+            err = filt_run_hist(args, &tm_hist, tm_q, FILT_SKETCH_NQ, tf_q, FILT_SKETCH_NQ, res);
+        }
+        free(tm_hist.pbin);
+    }
 
+    free(tm_q);
+    free(tf_q);
+    kll_free(&tm_kll);
+    kll_free(&tf_kll);
+    return err;
+}
+
+// Spreading the mass of each bin of the last trh over the bins of a new grid,
+// in proportion to their overlap. x is indexed like tmh.
+static void
+online_remap(prob_hist_t *trh, prob_hist_t *tmh, i64 shift, double *x) {
+    u64 j = 0;
+
+    for (u64 i = 0; i < tmh->nbin; i ++) {
+        x[i] = 0;
+    }
+    for (u64 i = 0; i + 1 < trh->nbin; i ++) {
+        i64 l = trh->pbin[i].t, r = trh->pbin[i+1].t;
+        if (trh->pbin[i].p <= 0 || r <= l) {
+            continue;
+        }
+        while (j + 2 < tmh->nbin && tmh->pbin[j+1].t - shift <= l) {
+            j ++;
+        }
+        for (u64 k = j; k + 1 < tmh->nbin; k ++) {
+            i64 nl = tmh->pbin[k].t - shift, nr = tmh->pbin[k+1].t - shift;
+            i64 lo = l > nl ? l : nl, hi = r < nr ? r : nr;
+            if (nl >= r) {
+                break;
+            }
+            if (hi > lo) {
+                x[k] += trh->pbin[i].p * (double)(hi - lo) / (double)(r - l);
+            }
+        }
+    }
+}
+
+int
+filt_online_init(filt_online_t *ol, filt_param_t *args, i64 *tf_arr, u64 tf_len) {
+    ol->args = *args;
+    ol->args.solver = FILT_SOLVER_EM;
+    ol->args.x0 = NULL;
+    if (ol->args.sketch_k == 0) {
+        ol->args.sketch_k = 2048;
+    }
+    ol->tf_arr = tf_arr;
+    ol->tf_len = tf_len;
+    chist_init(&ol->ch, (i64)args->width);
+    kll_init(&ol->kll, ol->args.sketch_k, ol->args.seed);
+    ol->tmh.nbin = 0;
+    ol->tmh.pbin = NULL;
+    ol->trh.nbin = 0;
+    ol->trh.pbin = NULL;
+    ol->nupdate = 0;
     return 0;
 }
 
-/*=== END: Main Entry ===*/
+int
+filt_online_update(filt_online_t *ol, i64 *tm_arr, u64 tm_len, filt_result_t *res) {
+    filt_param_t args = ol->args;
+    prob_hist_t tmh, trh;
+    i64 *tm_q = NULL;
+    double t0 = prof_now();
+    int err = 0;
+
+    for (u64 i = 0; i < tm_len && err == 0; i ++) {
+        err = chist_add(&ol->ch, tm_arr[i]);
+        if (err == 0) {
+            err = kll_update(&ol->kll, tm_arr[i]);
+        }
+    }
+    if (err) {
+        printf("[FilT-filt_online_update] ERROR, adding samples failed.\n");
+        return err;
+    }
+    prof_add(args.prof, FILT_PROF_READ, -1, t0);
+    FILT_LOG(FILT_LOG_INFO, "[FilT-filt_online_update] Update %lu, %lu new of %lu samples.\n",
+             ol->nupdate, tm_len, ol->ch.n);
+
+    t0 = prof_now();
+    err = slice_chist(&ol->ch, args.p_xcut, args.p_low, &tmh);
+    prof_add(args.prof, FILT_PROF_SLICE, -1, t0);
+    if (err) {
+        printf("[FilT-filt_online_update] Error in slicing met histogram. ERRCODE %d\n", err);
+        return err;
+    }
+    tm_q = (i64 *)malloc(FILT_SKETCH_NQ * sizeof(i64));
+    if (ol->trh.nbin > 0) {
+        args.x0 = (double *)malloc(tmh.nbin * sizeof(double));
+    }
+    if (tm_q == NULL || (ol->trh.nbin > 0 && args.x0 == NULL)) {
+        printf("[FilT-filt_online_update] ERROR, quantile array allocation failed.\n");
+        err = errno;
+        goto EXIT;
+    }
+    err = kll_quantiles(&ol->kll, FILT_SKETCH_NQ, args.p_xcut, tm_q);
+    if (err) {
+        goto EXIT;
+    }
+    if (args.x0 != NULL) {
+        online_remap(&ol->trh, &tmh, ol->tf_arr[0], args.x0);
+    }
+    err = filt_run_hist(&args, &tmh, tm_q, FILT_SKETCH_NQ, ol->tf_arr, ol->tf_len, res);
+    if (err) {
+        goto EXIT;
+    }
+
+    // Keeping a copy of trh, res is the caller's.
+    trh.nbin = res->tr_hist.nbin;
+    trh.pbin = (prob_bin_t *)malloc(trh.nbin * sizeof(prob_bin_t));
+    if (trh.pbin == NULL) {
+        printf("[FilT-filt_online_update] ERROR, trh allocation failed.\n");
+        err = errno;
+        filt_result_free(res);
+        goto EXIT;
+    }
+    memcpy(trh.pbin, res->tr_hist.pbin, trh.nbin * sizeof(prob_bin_t));
+    free(ol->tmh.pbin);
+    free(ol->trh.pbin);
+    ol->tmh = tmh;
+    ol->trh = trh;
+    tmh.pbin = NULL;
+    ol->nupdate ++;
+
+EXIT:
+    free(tmh.pbin);
+    free(tm_q);
+    free(args.x0);
+    return err;
+}
+
+void
+filt_online_free(filt_online_t *ol) {
+    chist_free(&ol->ch);
+    kll_free(&ol->kll);
+    free(ol->tmh.pbin);
+    free(ol->trh.pbin);
+    ol->tmh.pbin = NULL;
+    ol->trh.pbin = NULL;
+}
+
+/*=== END: Implementations ===*/
@@ -2,18 +2,86 @@
  * @file filt.h 
  * @author Key Liao
  * 
+ * Interfaces of libfilt. filt.x is a command-line front end of this library.
  */
 
+#ifndef _FILT_H
+#define _FILT_H
+
 #include <stdint.h>
+#include <pthread.h>
 
 #define i64 int64_t
 #define u64 uint64_t
 #define i32 int32_t
 #define u32 uint32_t
 
-/*=== BEGIN: Global Variables ===*/
+#define FILT_MODE_MC    0   // Monte Carlo forward model in calc_tr.
+#define FILT_MODE_CONV  1   // Exact convolution forward model in calc_tr.
+
+#define FILT_SOLVER_SWEEP   0   // calc_tr fixes bins from left to right.
+#define FILT_SOLVER_EM      1   // calc_tr updates all bins by Richardson-Lucy iterations.
+
+#define FILT_LOG_QUIET  0       // Errors only.
+#define FILT_LOG_INFO   1       // Progress of each phase, the default.
+#define FILT_LOG_DEBUG  2       // Every calc_tr bin and optimization step.
+
+// Printing at a libfilt log level, set by filt_set_verbose.
+#define FILT_LOG(level, ...) do { if (filt_get_verbose() >= (level)) printf(__VA_ARGS__); } while (0)
+
+#define FILT_PROF_READ          0
+#define FILT_PROF_SORT          1
+#define FILT_PROF_SLICE         2
+#define FILT_PROF_CALC_TR       3
+#define FILT_PROF_SIM_VERIFY    4
+#define FILT_PROF_CALC_W        5
+#define FILT_PROF_BOOTSTRAP     6
+#define FILT_NPHASE             7
+
+#ifndef NTILE
+#define NTILE 1000          // Default of filt_param_t.ntile.
+#endif
+
+#ifndef FILT_ADAPT_NSAMP0
+#define FILT_ADAPT_NSAMP0 4096              // First sample count of an adaptive calc_tr bin.
+#endif
+
+#define FILT_TFC_SUFFIX ".filtc"            // Cache of a sorted, cut sample file.
+
+#ifndef FILT_BOOT_LEVEL
+#define FILT_BOOT_LEVEL 0.95                // Confidence level of bootstrap intervals.
+#endif
+
+#ifndef FILT_STREAM_BLOCK
+#define FILT_STREAM_BLOCK (64UL << 20)      // Read size of streaming inputs.
+#endif
 
-static double er, ep;
+#ifndef FILT_SKETCH_NQ
+#define FILT_SKETCH_NQ 65536                // Quantiles taken from a sketch.
+#endif
+
+#ifndef FILT_WARM_FLOOR
+#define FILT_WARM_FLOOR 1e-3                // Flat share mixed into a warm start of calc_tr_em.
+#endif
+
+/*=== BEGIN: Types ===*/
+
+typedef struct FilT_Prof_Event_T {
+    int phase;              // FILT_PROF_*.
+    i64 bin;                // Bin of a calc_tr event, -1 otherwise.
+    double t0, dt;          // Start since filt_prof_t.t_start, and duration, in seconds.
+    u64 tid;
+} filt_prof_event_t;
+
+typedef struct FilT_Prof_T {
+    double t_start;
+    double sum[FILT_NPHASE];    // Seconds spent in each phase.
+    u64 cnt[FILT_NPHASE];
+    int trace;              // Keeping every event for prof_write_json.
+    filt_prof_event_t *ev;
+    u64 nev, nalloc;
+    pthread_mutex_t lock;   // Concurrent batch jobs share one profile.
+} filt_prof_t;
 
 typedef struct FilT_Param_T {
     u64 width;
@@ -24,8 +92,46 @@ typedef struct FilT_Param_T {
     char *in_tf_file;       // Input timing fluctuation samples.
     char *out_trh_file;      // Output real time estimation.
     char *out_sim_file;      // Output real time estimation.
+    char *batch_file;       // Manifest of batch jobs, NULL for a single run.
+    int njob;               // Number of concurrent batch jobs.
+    int nthread;            // Number of threads in simulations.
+    u64 seed;               // Key of the counter-based random generator.
+    int mode;               // Forward model in calc_tr, FILT_MODE_*.
+    u64 sketch_k;           // KLL size of streaming inputs, 0 to load whole files.
+    int solver;             // FILT_SOLVER_*.
+    u64 niter;              // Max iterations of FILT_SOLVER_EM.
+    int adaptive;           // Growing the samples of a calc_tr bin from FILT_ADAPT_NSAMP0 up to nsamp.
+    int tf_cache;           // Loading tf through a FILT_TFC_SUFFIX cache next to in_tf_file.
+    u64 ntile;              // Number of tiles in sim_cdf and w_arr, NTILE by default.
+    u64 nboot;              // Bootstrap replicates of calc_tr, 0 for none.
+    struct FilT_Prof_T *prof;   // Phase timers, NULL for none.
+    double *x0;             // Warm start of calc_tr_em on the tmh grid, NULL for a flat start.
+    struct FilT_TFD_T *tfd; // Compact copy of the tf array built by the caller, NULL to build one per run.
 } filt_param_t;
 
+typedef struct FilT_TFD_T {
+    i64 base;               // tf_arr[0], samples are kept as offsets from it.
+    u64 len;
+    int bits;               // 16 or 32, 0 if the range does not fit and tf_arr is read instead.
+    void *off;
+} filt_tfd_t;
+
+typedef struct FilT_MC_T {
+    u64 seed;
+    u64 stream;             // Advanced by every simulation, so each call draws a fresh sequence.
+    int nthread;
+    filt_tfd_t *tfd;        // Compact copy of tf_arr for the simulations, NULL to read tf_arr.
+} filt_mc_t;
+
+typedef struct FilT_Conv_T {
+    u64 nbin;
+    u64 *cell;              // Left edge of each tmh/trh bin, in width cells.
+    u64 nh;                 // Length of the tf kernel in cells.
+    double *hh;             // Double prefix sums of the tf kernel, nh+2 entries.
+} filt_conv_t;
+
+typedef void (*filt_task_fn)(void *arg, int ithread, u64 i0, u64 i1);
+
 typedef struct Prob_Bin_T {
     i64 t;
     double p;
@@ -36,22 +142,74 @@ typedef struct Prob_Hist_T {
     prob_bin_t *pbin;
 } prob_hist_t;
 
+typedef struct FilT_TFC_T {
+    i64 *arr;               // Sorted samples after the cut.
+    u64 len;
+    void *map;              // mmap of the cache holding arr, NULL if arr is malloc'ed.
+    u64 map_len;
+    filt_tfd_t tfd;         // Compact copy of arr, shared by every run on it.
+} filt_tfc_t;
+
+typedef struct FilT_KLL_T {
+    u64 k;                  // Capacity of the top level, rank error ~ 1/k.
+    u64 seed, ncoin;        // Coin flips of compactions.
+    u64 n;                  // Number of samples seen.
+    i64 min, max;
+    int nlevel;
+    i64 **items;            // Items of level h weigh 2^h.
+    u64 *len, *alloc;
+} filt_kll_t;
+
+typedef struct FilT_CHist_T {
+    i64 width;
+    i64 c0;                 // Cell index of cnts[0], cell c covers [c*width, (c+1)*width).
+    u64 ncell;
+    u64 *cnts;
+    u64 n;
+} filt_chist_t;
+
+typedef struct FilT_Result_T {
+    prob_hist_t tr_hist;    // Filtered real run time histogram.
+    u64 ntile;
+    i64 *sim_cdf;           // ntile+1 quantiles of the verification simulation.
+    i64 *w_arr;             // sim_cdf minus the quantiles of the measurements.
+    double *wp_arr;         // w_arr relative to the quantiles of the measurements.
+    double wd;              // W-distance between the simulation and the measurements.
+    double er;              // wd relative to the mean measured time.
+    double ep;              // |1 - total probability| of trh before normalizing.
+    u64 nboot;              // Bootstrap replicates behind p_lo and p_hi, 0 if not run.
+    double *p_lo, *p_hi;    // FILT_BOOT_LEVEL confidence interval of each tr_hist bin.
+} filt_result_t;
+
+typedef struct FilT_Online_T {
+    filt_param_t args;      // Copied by filt_online_init.
+    i64 *tf_arr;            // Sorted and cut timing fluctuations, not owned.
+    u64 tf_len;
+    filt_chist_t ch;        // Exact histogram of every measurement so far.
+    filt_kll_t kll;         // Quantiles of every measurement so far, for calc_w.
+    prob_hist_t tmh;        // Histogram of the last update.
+    prob_hist_t trh;        // Estimate of the last update, the warm start of the next.
+    u64 nupdate;
+} filt_online_t;
+
+typedef struct FilT_Sampler_T {
+    u64 nbin;
+    double pmax;            // Total probability of trh, pc[nbin-1].
+    double *pc;             // Cumulative probabilities of trh, pc[0] = 0.
+    i64 *tr;                // Left edges of trh bins.
+    i64 *tm;                // Left edges of tmh bins.
+} filt_sampler_t;
+
 //extern int errno;
 
-/*=== END: Global Variables ===*/
+/*=== END: Types ===*/
 
 /*=== BEGIN: Interfaces ===*/
 
-/**
- * Parsing input command-line arguments.
- * @param argc
- * @para argv
- */
-// int arg_parse(int argc, char **argv);
-
 /**
  * Slicing a rounded array to bins.
  * The min width is larger than args->rnd, the min probability is larger than args->p_low
+ * The array needs not be sorted, bins are indexed with integer division from its min.
  * @param arr Input array being sliced.
  * @param len The length of the input array.
  * @param p_low.
@@ -60,6 +218,15 @@ typedef struct Prob_Hist_T {
  */
 int slice(i64 *arr, u64 len, double p_low, i64 width, prob_hist_t *phist);
 
+/**
+ * Slicing an exact width histogram to bins, as slice does on an array.
+ * @param ch The histogram, its cells are not modified.
+ * @param pcut The highest probability being cut.
+ * @param p_low
+ * @param phist
+ */
+int slice_chist(filt_chist_t *ch, double pcut, double p_low, prob_hist_t *phist);
+
 /**
  * Reading csv file
  * @param fpath File path.
@@ -69,20 +236,164 @@ int slice(i64 *arr, u64 len, double p_low, i64 width, prob_hist_t *phist);
  */
 int read_csv(char *fpath, double pcut, u64 *len, i64 **arr);
 
+/**
+ * Reading and sorting a sample file through mmap.
+ * Text files hold one integer per line, and are parsed in newline-aligned
+ * chunks by nthread threads without copying the file. Files named *.bin
+ * hold raw little-endian int64 samples.
+ * @param fpath File path.
+ * @param pcut The highest probability being cut.
+ * @param nthread Number of parsing threads.
+ * @param len The length of returned array.
+ * @param arr Data array.
+ */
+int read_samples(char *fpath, double pcut, int nthread, u64 *len, i64 **arr);
+
+/**
+ * read_samples, timing the parsing as FILT_PROF_READ and the sorting as
+ * FILT_PROF_SORT of prof, which may be NULL.
+ */
+int read_samples_prof(char *fpath, double pcut, int nthread, filt_prof_t *prof, u64 *len, i64 **arr);
+
+/**
+ * Reading the samples appended to a file since *off. Only complete lines, or
+ * whole int64 records of a *.bin file, are taken, and *off is moved past them.
+ * Samples are not sorted or cut.
+ * @param fpath File path.
+ * @param off Offset in bytes of the first unread sample.
+ * @param len Number of new samples, 0 if there is none.
+ * @param arr Data array, NULL if there is no new sample.
+ */
+int read_samples_from(char *fpath, u64 *off, u64 *len, i64 **arr);
+
+/**
+ * Loading a sample file through the binary cache fpath FILT_TFC_SUFFIX. The
+ * cache holds the sorted array after the cut, keyed by a hash of the content
+ * of fpath and by pcut. A matching cache is mmap'ed, otherwise the file is
+ * read by read_samples and the cache is (re)written. Failing to write the
+ * cache is not an error. The compact copy tfc->tfd is built once here, so
+ * runs sharing tfc can pass it in args->tfd.
+ * @param fpath File path.
+ * @param pcut The highest probability being cut.
+ * @param nthread Number of hashing and parsing threads.
+ * @param use_cache 0 to call read_samples only.
+ * @param prof Phase timers, or NULL.
+ * @param tfc Released by tfc_free.
+ */
+int tfc_load(char *fpath, double pcut, int nthread, int use_cache, filt_prof_t *prof, filt_tfc_t *tfc);
+void tfc_free(filt_tfc_t *tfc);
+
+
+/**
+ * Streaming a sample file into a KLL sketch and an exact width histogram.
+ * Memory is bounded by FILT_STREAM_BLOCK, k and the range / width of the
+ * samples, not by the file size. Each thread summarizes its part of a block,
+ * and the summaries are merged at the end.
+ * @param fpath Text or *.bin file, as read_samples.
+ * @param nthread
+ * @param width Cell width of ch.
+ * @param k KLL size.
+ * @param seed
+ * @param ch The histogram, NULL if not needed. Released by chist_free.
+ * @param kll The sketch, released by kll_free.
+ */
+int read_summary(char *fpath, int nthread, i64 width, u64 k, u64 seed,
+                 filt_chist_t *ch, filt_kll_t *kll);
+
+/**
+ * Performing filtering with bounded memory: inputs are streamed into summaries
+ * by read_summary, tmh is sliced from the exact histogram, and FILT_SKETCH_NQ
+ * quantiles of the sketches stand for tm_arr and tf_arr.
+ * @param args FilT parameters, args->sketch_k > 0.
+ * @param res
+ */
+int run_filt_sketch(filt_param_t *args, filt_result_t *res);
+
+/**
+ * The part of filt_run after slicing, with a given histogram of tm_arr.
+ * @param args
+ * @param tmh Binned measurement times.
+ * @param tm_arr Sorted measurement array or its evenly spaced quantiles, for calc_w.
+ * @param tm_len
+ * @param tf_arr Sorted timing fluctuation array, or its evenly spaced quantiles.
+ * @param tf_len
+ * @param res
+ */
+int filt_run_hist(filt_param_t *args, prob_hist_t *tmh, i64 *tm_arr, u64 tm_len,
+                  i64 *tf_arr, u64 tf_len, filt_result_t *res);
+
+/**
+ * Bootstrap confidence intervals of trh. Each replicate resamples tm_arr and
+ * tf_arr with replacement, bins tm on the edges of tmh and runs calc_tr on a
+ * single thread. Replicates run concurrently on args->nthread threads over
+ * the shared, read-only inputs, and each draws from its own Philox streams,
+ * so the intervals do not depend on the thread count.
+ * @param args      args->nboot replicates.
+ * @param tmh       Histogram of tm_arr giving the bin edges.
+ * @param tm_arr    Sorted measurements after the cut.
+ * @param tm_len
+ * @param tf_arr    Sorted timing fluctuations after the cut.
+ * @param tf_len
+ * @param p_lo      Lower FILT_BOOT_LEVEL bound of each of the tmh->nbin bins.
+ * @param p_hi      Upper bound.
+ */
+int filt_bootstrap(filt_param_t *args, prob_hist_t *tmh, i64 *tm_arr, u64 tm_len,
+                   i64 *tf_arr, u64 tf_len, double *p_lo, double *p_hi);
+
+/**
+ * Setting the default parameters, the seed is taken from the clock.
+ * @param args
+ */
+void filt_param_init(filt_param_t *args);
 
 /**
- * Performing filtering with FilT, enclosing subroutines
+ * Sorting a sample array in place for filt_run, and cutting its highest pcut.
+ * @param arr
+ * @param n
+ * @param pcut
+ * @param nthread
+ * @return u64  The length of arr after cut.
+ */
+u64 filt_prep_samples(i64 *arr, u64 n, double pcut, int nthread);
+
+/**
+ * Performing filtering with FilT on in-memory arrays, reentrant.
+ * Both arrays are only read, and must be prepared by filt_prep_samples, so a
+ * tf array can be shared by concurrent calls.
+ * @param args FilT parameters, the file names are not used.
+ * @param tm_arr Sorted measurement array after cut.
+ * @param tm_len
+ * @param tf_arr Sorted timing fluctuation array after cut.
+ * @param tf_len
+ * @param res The filtered histogram and metrics, released by filt_result_free.
+ */
+int filt_run(filt_param_t *args, i64 *tm_arr, u64 tm_len, i64 *tf_arr, u64 tf_len,
+             filt_result_t *res);
+
+void filt_result_free(filt_result_t *res);
+
+/**
+ * Performing filtering with FilT on args->in_tm_file and args->in_tf_file.
  * @param args FilT parameters.
- * @param tr_hist Pointer to the histogram of filtered running times.
- * @param sim_cdf The 1000-tile cdf of the verification simulation 
+ * @param res The filtered histogram and metrics, released by filt_result_free.
  */
-int run_filt(filt_param_t *args, prob_hist_t *tr_hist, i64 *sim_cdf, i64 *w_arr, double *wp_arr);
+int run_filt(filt_param_t *args, filt_result_t *res);
 
 /**
  * Comparing function for qsort.
  */
 int cmp(const void *a, const void *b);
 
+/**
+ * Sorting an i64 array in place with an LSD radix sort, one byte per pass.
+ * Passes on bytes shared by every element are skipped, and each pass counts
+ * and scatters with nthread threads. Small arrays fall back to qsort.
+ * @param arr
+ * @param n
+ * @param nthread
+ */
+void sort_i64(i64 *arr, u64 n, int nthread);
+
 /**
  * @brief 
  * @param tmh   Binned meausrement times.
@@ -91,11 +402,103 @@ int cmp(const void *a, const void *b);
  * @param tf_arr    Sorted timing fluctuation raw array after cut.
  * @param tf_len    The length of tf_arr.
  * @param args      
+ * @param mc        Random generator state of the simulations.
+ * @param ep        |1 - total probability| of trh before normalizing.
  * @return int 
  */
-int calc_tr(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_t *args);
+int calc_tr(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_t *args,
+            filt_mc_t *mc, double *ep);
+
+/**
+ * Global Richardson-Lucy (EM) solver of trh, taken by calc_tr when
+ * args->solver is FILT_SOLVER_EM. The response of each trh bin comes from the
+ * exact convolution kernel, and every iteration updates all bins at once:
+ *   x[ir] *= sum_im A[im][ir] * tmh[im] / (A x)[im] / sum_im A[im][ir]
+ * Iterations stop after args->niter, or when every |(A x)[im] - tmh[im]| is
+ * below 0.01 * p_low. Both passes of an iteration run on args->nthread threads.
+ * Iterations start from a flat trh, or from args->x0 mixed with a FILT_WARM_FLOOR
+ * share of the flat one, so bins at 0 in x0 can still grow.
+ * @param tmh
+ * @param trh
+ * @param tf_arr
+ * @param tf_len
+ * @param args
+ * @param ep    |1 - total probability| of trh before normalizing.
+ */
+int calc_tr_em(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, filt_param_t *args,
+               double *ep);
+
+/**
+ * Exact W-distance (W1) between the sorted tm_arr and the sorted simulated
+ * samples, by one merge over both arrays. Only the lowest 1 - p_zcut of both
+ * distributions are compared.
+ * @param tm_arr    Sorted measurements.
+ * @param tm_len
+ * @param sim_arr   Sorted simulated samples from sim_verify.
+ * @param sim_len
+ * @param ntile     w_arr and wp_arr are compared at the ntile-tiles.
+ * @param sim_cdf   ntile+1 tiles of sim_arr.
+ * @param w_arr     sim_cdf minus the tiles of tm_arr.
+ * @param wp_arr    w_arr relative to the tiles of tm_arr.
+ * @param p_zcut
+ * @param wd    The W-distance, mean |tm - sim| over the compared quantiles (ns).
+ * @param er    wd relative to the mean of the compared tm_arr.
+ */
+void calc_w(i64 *tm_arr, u64 tm_len, i64 *sim_arr, u64 sim_len, u64 ntile, i64 *sim_cdf, i64 *w_arr,
+            double *wp_arr, double p_zcut, double *wd, double *er);
+
+/**
+ * Counter-based random generator (Philox4x32-10).
+ * The output only depends on (seed, stream, ctr), so a sample gets the same
+ * numbers no matter which thread draws it.
+ * @param seed
+ * @param stream
+ * @param ctr   Sample index.
+ * @param u     Two uniform numbers in [0, 1).
+ */
+void filt_rng_u01(u64 seed, u64 stream, u64 ctr, double *u);
+
+/**
+ * Splitting [0, n) to nthread contiguous ranges and running fn on each with pthreads.
+ * The caller thread runs the first range.
+ */
+void filt_parallel_for(int nthread, u64 n, filt_task_fn fn, void *arg);
+
+/**
+ * Storing sorted tf samples as 16-bit, or else 32-bit, offsets from tf_arr[0],
+ * so the random reads of the simulations touch 1/4 or 1/2 of the memory of
+ * tf_arr. If the range fits neither, tfd->bits is 0 and tf_arr is read.
+ * @param tfd   Released by tfd_free, tf_arr is not referenced.
+ */
+int tfd_init(filt_tfd_t *tfd, i64 *tf_arr, u64 tf_len);
+void tfd_free(filt_tfd_t *tfd);
+
+/**
+ * Building the sampling tables of trh and tmh, once per simulation.
+ * Each draw then costs O(log nbin) instead of O(nbin).
+ * @param tmh   Binned measurement times, used for bucketing.
+ * @param trh   Binned real time estimations, used for drawing.
+ * @param smp   The sampler, released by sampler_free.
+ */
+int sampler_init(prob_hist_t *tmh, prob_hist_t *trh, filt_sampler_t *smp);
 
-void calc_w(i64 *tm_arr, u64 tm_len, i64 *sim_cdf, i64 *w_arr, double *wp_arr, double p_zcut);
+void sampler_free(filt_sampler_t *smp);
+
+/**
+ * Drawing a real time from trh by inverting its cumulative probability.
+ * @param smp
+ * @param px    A probability in [0, smp->pmax).
+ * @return i64  The linearly interpolated time inside the located bin.
+ */
+i64 sampler_draw_tr(filt_sampler_t *smp, double px);
+
+/**
+ * Locating the tmh bin of a simulated measurement time.
+ * @param smp
+ * @param tsim
+ * @return u64  The bin index, or smp->nbin if tsim falls out of tmh.
+ */
+u64 sampler_bucket(filt_sampler_t *smp, i64 tsim);
 
 /**
  * @brief 
@@ -104,10 +507,60 @@ void calc_w(i64 *tm_arr, u64 tm_len, i64 *sim_cdf, i64 *w_arr, double *wp_arr, d
  * @param tf_arr 
  * @param tf_len 
  * @param psim 
- * @param args 
+ * @param nsamp
+ * @param mc 
  * @return int 
  */
-int sim_met(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, double *psim, u64 nsamp);
+int sim_met(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, double *psim, u64 nsamp,
+            filt_mc_t *mc);
+
+/**
+ * Binning tf samples onto the width grid of tmh, once per calc_tr.
+ * tmh edges must be multiples of width from tmh->pbin[0].t, as slice makes.
+ * @param tmh
+ * @param tf_arr    Sorted timing fluctuation array.
+ * @param tf_len
+ * @param width     The grid width of tmh.
+ * @param conv      The kernel, released by conv_free.
+ */
+int conv_init(prob_hist_t *tmh, i64 *tf_arr, u64 tf_len, i64 width, filt_conv_t *conv);
+
+void conv_free(filt_conv_t *conv);
+
+/**
+ * Exact counterpart of sim_met: the probabilities of tmh bins for tr uniform
+ * inside each trh bin, convolved with the tf samples. No sampling noise.
+ * @param conv
+ * @param trh
+ * @param psim
+ */
+void conv_met(filt_conv_t *conv, prob_hist_t *trh, double *psim);
+
+/**
+ * Adding the exact contribution of mass p in trh bin ir to psim.
+ * @param conv
+ * @param ir
+ * @param p
+ * @param psim
+ */
+void conv_met_bin(filt_conv_t *conv, u64 ir, double p, double *psim);
+
+/**
+ * Simulating the contribution of a unit mass in trh bin ir alone, with tr
+ * uniform in the bin. calc_tr scales it by the bin probability and adds it
+ * to the cached contribution of the fixed bins.
+ * @param tmh
+ * @param trh
+ * @param ir
+ * @param tf_arr
+ * @param tf_len
+ * @param pcol  Probabilities of tmh bins, sum to 1.
+ * @param nsamp
+ * @param mc
+ * @return int
+ */
+int sim_met_bin(prob_hist_t *tmh, prob_hist_t *trh, u64 ir, i64 *tf_arr, u64 tf_len, double *pcol,
+                u64 nsamp, filt_mc_t *mc);
 
 /**
  * @brief 
@@ -115,10 +568,103 @@ int sim_met(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, double
  * @param trh 
  * @param tf_arr 
  * @param tf_len 
- * @param sim_cdf
+ * @param ntile
+ * @param sim_cdf    ntile+1 tiles of the simulated samples.
  * @param nsamp 
+ * @param mc
+ * @param sim_sorted Receives the nsamp sorted samples, to be freed by the caller.
  * @return int 
  */
-int sim_verify(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, i64 *sim_cdf, u64 nsamp);
+int sim_verify(prob_hist_t *tmh, prob_hist_t *trh, i64 *tf_arr, u64 tf_len, u64 ntile, i64 *sim_cdf,
+               u64 nsamp, filt_mc_t *mc, i64 **sim_sorted);
+
+/**
+ * Starting an incremental FilT, which keeps tmh and trh between updates.
+ * The solver is always FILT_SOLVER_EM, so each update starts from the last trh.
+ * Measurements are kept in a width histogram and a KLL sketch of args->sketch_k
+ * (2048 if 0), so memory does not grow with the number of samples.
+ * @param args Copied, args->x0 is ignored.
+ * @param tf_arr Sorted and cut timing fluctuations, kept until filt_online_free.
+ */
+int filt_online_init(filt_online_t *ol, filt_param_t *args, i64 *tf_arr, u64 tf_len);
+
+/**
+ * Adding a batch of measurements and re-running calc_tr from the last
+ * estimate, mapped to the new tmh grid. When the distribution has not drifted,
+ * the em solver stops after a few iterations. On error, the state is kept as
+ * before the call, except that the new samples have been added.
+ * @param tm_arr New measurements, in any order, not cut.
+ * @param res Results on every measurement so far, released by filt_result_free.
+ */
+int filt_online_update(filt_online_t *ol, i64 *tm_arr, u64 tm_len, filt_result_t *res);
+
+void filt_online_free(filt_online_t *ol);
 
 /*=== END: Interfaces ===*/
+
+/*=== BEGIN: Profiling Interfaces (prof.c) ===*/
+
+/**
+ * @brief Set the log level of libfilt, FILT_LOG_*. ERROR lines are always printed.
+ */
+void filt_set_verbose(int level);
+int filt_get_verbose(void);
+
+/**
+ * @brief Monotonic wall time in seconds.
+ */
+double prof_now(void);
+
+/**
+ * @param trace     Keeping every timed span for prof_write_json, otherwise only the sums.
+ */
+void prof_init(filt_prof_t *prof, int trace);
+void prof_free(filt_prof_t *prof);
+
+/**
+ * @brief Add the span from t0 (a prof_now value) to now to a phase. No-op if prof is NULL.
+ * @param bin       Bin index of a calc_tr span, -1 otherwise.
+ */
+void prof_add(filt_prof_t *prof, int phase, i64 bin, double t0);
+
+/**
+ * @brief Print the seconds, count and share of the wall time of each phase.
+ */
+void prof_print(filt_prof_t *prof);
+
+/**
+ * @brief Write the events in the Chrome trace event format, for chrome://tracing or Perfetto.
+ */
+int prof_write_json(filt_prof_t *prof, char *fpath);
+
+/*=== END: Profiling Interfaces ===*/
+
+/*=== BEGIN: Sketch Interfaces (sketch.c) ===*/
+
+int kll_init(filt_kll_t *kll, u64 k, u64 seed);
+void kll_free(filt_kll_t *kll);
+int kll_update(filt_kll_t *kll, i64 v);
+
+/**
+ * Merging src into dst, src is not modified.
+ */
+int kll_merge(filt_kll_t *dst, filt_kll_t *src);
+
+/**
+ * Evenly spaced quantiles of the lowest (1 - pcut), q[j] at rank (j+0.5)/nq.
+ * q[0] is the exact minimum, so q works as a sorted sample array.
+ * @param kll
+ * @param nq
+ * @param pcut
+ * @param q     nq quantiles, sorted.
+ */
+int kll_quantiles(filt_kll_t *kll, u64 nq, double pcut, i64 *q);
+
+void chist_init(filt_chist_t *ch, i64 width);
+void chist_free(filt_chist_t *ch);
+int chist_add(filt_chist_t *ch, i64 v);
+int chist_merge(filt_chist_t *dst, filt_chist_t *src);
+
+/*=== END: Sketch Interfaces ===*/
+
+#endif
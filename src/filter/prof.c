@@ -0,0 +1,133 @@
+/**
+ * @file prof.c
+ * @author Key Liao
+ *
+ * Log level and phase timers of libfilt. Each phase accumulates its wall time and count,
+ * and with tracing on every timed span is kept as an event for a JSON trace
+ * (Chrome trace event format, viewable in chrome://tracing or Perfetto).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "filt.h"
+
+static const char *prof_names[FILT_NPHASE] = {
+    "read", "sort", "slice", "calc_tr", "sim_verify", "calc_w", "bootstrap"
+};
+
+static int filt_verbose = FILT_LOG_INFO;
+
+void
+filt_set_verbose(int level) {
+    filt_verbose = level;
+}
+
+int
+filt_get_verbose(void) {
+    return filt_verbose;
+}
+
+double
+prof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+void
+prof_init(filt_prof_t *prof, int trace) {
+    prof->t_start = prof_now();
+    for (int i = 0; i < FILT_NPHASE; i ++) {
+        prof->sum[i] = 0;
+        prof->cnt[i] = 0;
+    }
+    prof->trace = trace;
+    prof->ev = NULL;
+    prof->nev = 0;
+    prof->nalloc = 0;
+    pthread_mutex_init(&prof->lock, NULL);
+}
+
+void
+prof_free(filt_prof_t *prof) {
+    free(prof->ev);
+    prof->ev = NULL;
+    prof->nev = 0;
+    prof->nalloc = 0;
+    pthread_mutex_destroy(&prof->lock);
+}
+
+void
+prof_add(filt_prof_t *prof, int phase, i64 bin, double t0) {
+    double dt;
+
+    if (prof == NULL) {
+        return;
+    }
+    dt = prof_now() - t0;
+    pthread_mutex_lock(&prof->lock);
+    prof->sum[phase] += dt;
+    prof->cnt[phase] ++;
+    if (prof->trace) {
+        if (prof->nev == prof->nalloc) {
+            u64 nalloc = prof->nalloc ? prof->nalloc * 2 : 1024;
+            filt_prof_event_t *ev = (filt_prof_event_t *)realloc(prof->ev, nalloc * sizeof(filt_prof_event_t));
+            if (ev != NULL) {
+                prof->ev = ev;
+                prof->nalloc = nalloc;
+            }
+        }
+        // Events are dropped rather than failing the run when memory is short.
+        if (prof->nev < prof->nalloc) {
+            filt_prof_event_t *e = &prof->ev[prof->nev ++];
+            e->phase = phase;
+            e->bin = bin;
+            e->t0 = t0 - prof->t_start;
+            e->dt = dt;
+            e->tid = (u64)pthread_self();
+        }
+    }
+    pthread_mutex_unlock(&prof->lock);
+}
+
+void
+prof_print(filt_prof_t *prof) {
+    double total = prof_now() - prof->t_start;
+
+    printf("[FilT-prof] %-12s %12s %10s %8s\n", "phase", "seconds", "count", "share");
+    for (int i = 0; i < FILT_NPHASE; i ++) {
+        if (prof->cnt[i] == 0) {
+            continue;
+        }
+        printf("[FilT-prof] %-12s %12.6f %10lu %7.2f%%\n", prof_names[i], prof->sum[i],
+                prof->cnt[i], total > 0 ? prof->sum[i] / total * 100 : 0);
+    }
+    printf("[FilT-prof] %-12s %12.6f\n", "wall", total);
+}
+
+int
+prof_write_json(filt_prof_t *prof, char *fpath) {
+    FILE *fp = fopen(fpath, "w");
+
+    if (fp == NULL) {
+        printf("[FilT-prof] ERROR, cannot open %s.\n", fpath);
+        return errno;
+    }
+    fprintf(fp, "{\"traceEvents\":[");
+    for (u64 i = 0; i < prof->nev; i ++) {
+        filt_prof_event_t *e = &prof->ev[i];
+        fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%lu,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bin\":%ld}}",
+                i ? "," : "", prof_names[e->phase], e->tid, e->t0 * 1e6, e->dt * 1e6, e->bin);
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(fp);
+    printf("[FilT-prof] %lu trace events written to %s.\n", prof->nev, fpath);
+
+    return 0;
+}
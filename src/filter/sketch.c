@@ -0,0 +1,324 @@
+/**
+ * @file sketch.c
+ * @author Key Liao
+ *
+ * Mergeable summaries of sample streams, for inputs that do not fit in memory:
+ * a KLL quantile sketch, and an exact histogram of width cells.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "filt.h"
+
+/*=== BEGIN: KLL sketch ===*/
+
+typedef struct KLL_Item_T {
+    i64 v;
+    u64 w;
+} kll_item_t;
+
+static int
+cmp_kll_item(const void *a, const void *b) {
+    i64 x = ((const kll_item_t *)a)->v, y = ((const kll_item_t *)b)->v;
+    return (x > y) - (x < y);
+}
+
+// Capacity of level h when the sketch has nlevel levels, the top level holds k.
+static u64
+kll_level_cap(filt_kll_t *kll, int h) {
+    u64 cap = (u64)((double)kll->k * pow(2.0 / 3.0, (double)(kll->nlevel - 1 - h)));
+    return cap < 8 ? 8 : cap;
+}
+
+static int
+kll_push(filt_kll_t *kll, int h, i64 v) {
+    if (h >= kll->nlevel) {
+        int nlevel = h + 1;
+        i64 **items = (i64 **)realloc(kll->items, nlevel * sizeof(i64 *));
+        u64 *len = (u64 *)realloc(kll->len, nlevel * sizeof(u64));
+        u64 *alloc = (u64 *)realloc(kll->alloc, nlevel * sizeof(u64));
+        if (items != NULL) kll->items = items;
+        if (len != NULL) kll->len = len;
+        if (alloc != NULL) kll->alloc = alloc;
+        if (items == NULL || len == NULL || alloc == NULL) {
+            return ENOMEM;
+        }
+        for (int l = kll->nlevel; l < nlevel; l ++) {
+            kll->items[l] = NULL;
+            kll->len[l] = 0;
+            kll->alloc[l] = 0;
+        }
+        kll->nlevel = nlevel;
+    }
+    if (kll->len[h] == kll->alloc[h]) {
+        u64 alloc = kll->alloc[h] < 16 ? 16 : kll->alloc[h] * 2;
+        i64 *items = (i64 *)realloc(kll->items[h], alloc * sizeof(i64));
+        if (items == NULL) {
+            return ENOMEM;
+        }
+        kll->items[h] = items;
+        kll->alloc[h] = alloc;
+    }
+    kll->items[h][kll->len[h] ++] = v;
+    return 0;
+}
+
+// Sorting level h and promoting every other item to level h+1 with doubled weight.
+static int
+kll_compact(filt_kll_t *kll, int h) {
+    u64 n2 = kll->len[h] & ~(u64)1;
+    u64 coin;
+    double u[2];
+    int err = 0;
+
+    qsort(kll->items[h], kll->len[h], sizeof(i64), cmp);
+    filt_rng_u01(kll->seed, 0, kll->ncoin ++, u);
+    coin = u[0] < 0.5 ? 0 : 1;
+    for (u64 i = coin; i < n2; i += 2) {
+        err = kll_push(kll, h + 1, kll->items[h][i]);
+        if (err) {
+            return err;
+        }
+    }
+    // An odd item stays at level h.
+    if (kll->len[h] > n2) {
+        kll->items[h][0] = kll->items[h][n2];
+    }
+    kll->len[h] -= n2;
+    return 0;
+}
+
+static int
+kll_compress(filt_kll_t *kll) {
+    while (1) {
+        u64 size = 0, cap = 0;
+        int h;
+        for (h = 0; h < kll->nlevel; h ++) {
+            size += kll->len[h];
+            cap += kll_level_cap(kll, h);
+        }
+        if (size <= cap) {
+            return 0;
+        }
+        for (h = 0; h < kll->nlevel; h ++) {
+            if (kll->len[h] >= kll_level_cap(kll, h)) {
+                break;
+            }
+        }
+        // No level is full, compacting the lowest one that can shrink.
+        if (h == kll->nlevel) {
+            for (h = 0; h < kll->nlevel && kll->len[h] < 2; h ++);
+            if (h == kll->nlevel) {
+                return 0;
+            }
+        }
+        if (kll_compact(kll, h)) {
+            return ENOMEM;
+        }
+    }
+}
+
+int
+kll_init(filt_kll_t *kll, u64 k, u64 seed) {
+    kll->k = k < 8 ? 8 : k;
+    kll->seed = seed;
+    kll->ncoin = 0;
+    kll->n = 0;
+    kll->min = INT64_MAX;
+    kll->max = INT64_MIN;
+    kll->nlevel = 0;
+    kll->items = NULL;
+    kll->len = NULL;
+    kll->alloc = NULL;
+    return 0;
+}
+
+void
+kll_free(filt_kll_t *kll) {
+    for (int h = 0; h < kll->nlevel; h ++) {
+        free(kll->items[h]);
+    }
+    free(kll->items);
+    free(kll->len);
+    free(kll->alloc);
+    kll->items = NULL;
+    kll->len = NULL;
+    kll->alloc = NULL;
+    kll->nlevel = 0;
+}
+
+int
+kll_update(filt_kll_t *kll, i64 v) {
+    int err;
+
+    kll->n ++;
+    kll->min = v < kll->min ? v : kll->min;
+    kll->max = v > kll->max ? v : kll->max;
+    err = kll_push(kll, 0, v);
+    if (err == 0 && kll->len[0] >= kll_level_cap(kll, 0)) {
+        err = kll_compress(kll);
+    }
+    return err;
+}
+
+int
+kll_merge(filt_kll_t *dst, filt_kll_t *src) {
+    for (int h = 0; h < src->nlevel; h ++) {
+        for (u64 i = 0; i < src->len[h]; i ++) {
+            if (kll_push(dst, h, src->items[h][i])) {
+                return ENOMEM;
+            }
+        }
+    }
+    dst->n += src->n;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+    return kll_compress(dst);
+}
+
+int
+kll_quantiles(filt_kll_t *kll, u64 nq, double pcut, i64 *q) {
+    kll_item_t *items;
+    u64 nitem = 0, wtot = 0, cw = 0, j = 0;
+
+    for (int h = 0; h < kll->nlevel; h ++) {
+        nitem += kll->len[h];
+    }
+    if (nitem == 0 || nq == 0) {
+        return EINVAL;
+    }
+    items = (kll_item_t *)malloc(nitem * sizeof(kll_item_t));
+    if (items == NULL) {
+        return ENOMEM;
+    }
+    nitem = 0;
+    for (int h = 0; h < kll->nlevel; h ++) {
+        for (u64 i = 0; i < kll->len[h]; i ++) {
+            items[nitem].v = kll->items[h][i];
+            items[nitem].w = (u64)1 << h;
+            wtot += items[nitem].w;
+            nitem ++;
+        }
+    }
+    qsort(items, nitem, sizeof(kll_item_t), cmp_kll_item);
+
+    // q[j] is the value at rank (j + 0.5) / nq of the lowest (1 - pcut).
+    for (u64 i = 0; i < nitem && j < nq; i ++) {
+        cw += items[i].w;
+        while (j < nq && ((double)j + 0.5) / (double)nq * (1.0 - pcut) * (double)wtot < (double)cw) {
+            q[j ++] = items[i].v;
+        }
+    }
+    for (; j < nq; j ++) {
+        q[j] = items[nitem-1].v;
+    }
+    // The exact minimum is kept, calc_tr shifts trh by tf_arr[0].
+    q[0] = kll->min;
+
+    free(items);
+    return 0;
+}
+
+/*=== END: KLL sketch ===*/
+
+/*=== BEGIN: Exact histogram of width cells ===*/
+
+void
+chist_init(filt_chist_t *ch, i64 width) {
+    ch->width = width;
+    ch->c0 = 0;
+    ch->ncell = 0;
+    ch->cnts = NULL;
+    ch->n = 0;
+}
+
+void
+chist_free(filt_chist_t *ch) {
+    free(ch->cnts);
+    ch->cnts = NULL;
+    ch->ncell = 0;
+}
+
+// Floor division, so cells are anchored at multiples of width.
+static inline i64
+chist_cell(filt_chist_t *ch, i64 v) {
+    i64 c = v / ch->width;
+    return (v % ch->width != 0 && v < 0) ? c - 1 : c;
+}
+
+// Growing the cell range to cover [c_lo, c_hi], doubling to amortize.
+static int
+chist_cover(filt_chist_t *ch, i64 c_lo, i64 c_hi) {
+    i64 lo, hi, n;
+    u64 *cnts;
+
+    if (ch->ncell > 0) {
+        if (c_lo >= ch->c0 && c_hi < ch->c0 + (i64)ch->ncell) {
+            return 0;
+        }
+        lo = c_lo < ch->c0 ? c_lo : ch->c0;
+        hi = c_hi >= ch->c0 + (i64)ch->ncell ? c_hi : ch->c0 + (i64)ch->ncell - 1;
+        n = hi - lo + 1;
+        if (n < 2 * (i64)ch->ncell) {
+            // Extending on the side being grown.
+            if (lo < ch->c0) {
+                lo = hi - 2 * (i64)ch->ncell + 1;
+            } else {
+                hi = lo + 2 * (i64)ch->ncell - 1;
+            }
+            n = hi - lo + 1;
+        }
+    } else {
+        lo = c_lo;
+        hi = c_hi;
+        n = hi - lo + 1;
+    }
+    cnts = (u64 *)calloc((u64)n, sizeof(u64));
+    if (cnts == NULL) {
+        return ENOMEM;
+    }
+    if (ch->ncell > 0) {
+        memcpy(cnts + (ch->c0 - lo), ch->cnts, ch->ncell * sizeof(u64));
+    }
+    free(ch->cnts);
+    ch->cnts = cnts;
+    ch->c0 = lo;
+    ch->ncell = (u64)n;
+    return 0;
+}
+
+int
+chist_add(filt_chist_t *ch, i64 v) {
+    i64 c = chist_cell(ch, v);
+    int err = chist_cover(ch, c, c);
+
+    if (err == 0) {
+        ch->cnts[c - ch->c0] ++;
+        ch->n ++;
+    }
+    return err;
+}
+
+int
+chist_merge(filt_chist_t *dst, filt_chist_t *src) {
+    int err;
+
+    if (src->ncell == 0) {
+        return 0;
+    }
+    err = chist_cover(dst, src->c0, src->c0 + (i64)src->ncell - 1);
+    if (err) {
+        return err;
+    }
+    for (u64 i = 0; i < src->ncell; i ++) {
+        dst->cnts[src->c0 - dst->c0 + (i64)i] += src->cnts[i];
+    }
+    dst->n += src->n;
+    return 0;
+}
+
+/*=== END: Exact histogram of width cells ===*/
@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#ifndef PTOPT_USE_THREADS
 #include <mpi.h>
+#endif
 #include "pterr.h"
 #include "partes_types.h"
 #include "timers/clock_gettime.h"
@@ -30,14 +32,17 @@ _run_sub(uint64_t nsub, pt_timer_func_t *pttimers, pt_gauge_func_t *ptgauges)
 {
     int64_t res;
     _ptm_return_on_error(pttimers->init_timer(), "run_sub");
+#ifndef PTOPT_USE_THREADS
     MPI_Barrier(MPI_COMM_WORLD);
     MPI_Barrier(MPI_COMM_WORLD);
+#endif
     register int64_t t0 = pttimers->tick();
     ptgauges->run_gauge(nsub);
     res = pttimers->tock() - t0;
     return res;
 }
 
+#ifndef PTOPT_USE_THREADS
 /** 
  * @brief Exponential guessing to estimate theoretical time per sub-op
  * @param myrank: my rank
@@ -214,6 +219,7 @@ fit_sub_time(int myrank, int nrank, pt_timer_func_t *pttimers, pt_gauge_func_t *
 
     return PTERR_SUCCESS;
 }
+#endif
 
 int 
 exp_fit_gpns(int ntest, int64_t tmax, pt_timer_func_t *pttimers, pt_gauge_func_t *ptgauges, double *gpns) {
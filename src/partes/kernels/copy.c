@@ -17,7 +17,7 @@ typedef struct {
     double key;
 } data_copy_t;
 
-static data_copy_t *p_kdata_head[4] = {NULL, NULL, NULL, NULL};
+static __PTM_TLS data_copy_t *p_kdata_head[4] = {NULL, NULL, NULL, NULL};
 
 int init_kern_copy(size_t flush_kib, int id, size_t *flush_kib_real) {
     int err = PTERR_SUCCESS;
@@ -14,6 +14,8 @@
 #include "timers/timers.h"
 #include "gauges/gauges.h"
 #include "pterr.h"
+#include "ptsync.h"
+#include "ptio.h"
 
 #ifdef PTOPT_USE_MPI
 
@@ -47,6 +49,11 @@ print_usage(char *argv[])
         printf("  --timer <timer>     Timer method (clock_gettime, mpi_wtime, tsc_asym)\n");
         printf("  --gauge <gauge>     Gauge method (sub_scalar, fma_scalar, fma_avx2, fma_avx512)\n");
         printf("  --ntests <num>      Number of gauge measurements (default: 1000)\n");
+        printf("  --sync <method>     Barrier before each measurement (mpi, shm, time) (default: mpi)\n");
+        printf("  --period <ns>       Slot length of --sync time (default: measured)\n");
+        printf("  --output <format>   Raw samples of each rank (csv, mpiio) (default: csv)\n");
+        printf("  --output-file <path> File of --output mpiio (default: partes_raw.bin)\n");
+        printf("  --nthreads <num>    Pinned threads of partes-thr.x (default: all allowed CPUs)\n");
         printf("  --help, -h          Show this help message\n");
     }
 }
@@ -76,6 +83,13 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
     ptopts->ntests = 1000;
     ptopts->ntiles = 100;
     ptopts->cut_p = 1.0;
+    ptopts->sync = SYNC_MPI;
+    strcpy(ptopts->sync_name, "mpi");
+    ptopts->period = 0;
+    ptopts->output = OUTPUT_CSV;
+    strcpy(ptopts->output_name, "csv");
+    strcpy(ptopts->output_file, "partes_raw.bin");
+    ptopts->nthread = 0;
     ptopts->ta = INT64_MIN;
     ptopts->tb = INT64_MIN;
 
@@ -188,6 +202,7 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->cleanup_fkern_a = cleanup_kern_dgemm;
                     strcpy(ptopts->fkern_a_name, "dgemm");
                 } else if (strcmp(argv[i + 1], "mpi_bcast") == 0) {
+#ifdef PTOPT_USE_MPI
                     ptopts->fkern_a = KERN_MPI_BCAST;
                     ptfuncs->init_fkern_a = init_kern_mpi_bcast;
                     ptfuncs->run_fkern_a = run_kern_mpi_bcast;
@@ -195,6 +210,10 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->check_fkern_a_key = check_key_mpi_bcast;
                     ptfuncs->cleanup_fkern_a = cleanup_kern_mpi_bcast;
                     strcpy(ptopts->fkern_a_name, "mpi_bcast");
+#else
+                    fprintf(stderr, "mpi_bcast needs partes-mpi.x\n");
+                    return PTERR_INVALID_ARGUMENT;
+#endif
                 } else {
                     fprintf(stderr, "Unknown front kernel for ta: %s\n", argv[i + 1]);
                     return PTERR_INVALID_ARGUMENT;
@@ -260,6 +279,7 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->cleanup_fkern_b = cleanup_kern_dgemm;
                     strcpy(ptopts->fkern_b_name, "dgemm");
                 } else if (strcmp(argv[i + 1], "mpi_bcast") == 0) {
+#ifdef PTOPT_USE_MPI
                     ptopts->fkern_b = KERN_MPI_BCAST;
                     ptfuncs->init_fkern_b = init_kern_mpi_bcast;
                     ptfuncs->run_fkern_b = run_kern_mpi_bcast;
@@ -267,6 +287,10 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->check_fkern_b_key = check_key_mpi_bcast;
                     ptfuncs->cleanup_fkern_b = cleanup_kern_mpi_bcast;
                     strcpy(ptopts->fkern_b_name, "mpi_bcast");
+#else
+                    fprintf(stderr, "mpi_bcast needs partes-mpi.x\n");
+                    return PTERR_INVALID_ARGUMENT;
+#endif
                 } else {
                     fprintf(stderr, "Unknown front kernel for tb: %s\n", argv[i + 1]);
                     return PTERR_INVALID_ARGUMENT;
@@ -332,6 +356,7 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->cleanup_rkern_a = cleanup_kern_dgemm;
                     strcpy(ptopts->rkern_a_name, "dgemm");
                 } else if (strcmp(argv[i + 1], "mpi_bcast") == 0) {
+#ifdef PTOPT_USE_MPI
                     ptopts->rkern_a = KERN_MPI_BCAST;
                     ptfuncs->init_rkern_a = init_kern_mpi_bcast;
                     ptfuncs->run_rkern_a = run_kern_mpi_bcast;
@@ -339,6 +364,10 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->check_rkern_a_key = check_key_mpi_bcast;
                     ptfuncs->cleanup_rkern_a = cleanup_kern_mpi_bcast;
                     strcpy(ptopts->rkern_a_name, "mpi_bcast");
+#else
+                    fprintf(stderr, "mpi_bcast needs partes-mpi.x\n");
+                    return PTERR_INVALID_ARGUMENT;
+#endif
                 } else {
                     fprintf(stderr, "Unknown rear kernel for ta: %s\n", argv[i + 1]);
                     return PTERR_INVALID_ARGUMENT;
@@ -404,6 +433,7 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->cleanup_rkern_b = cleanup_kern_dgemm;
                     strcpy(ptopts->rkern_b_name, "dgemm");
                 } else if (strcmp(argv[i + 1], "mpi_bcast") == 0) {
+#ifdef PTOPT_USE_MPI
                     ptopts->rkern_b = KERN_MPI_BCAST;
                     ptfuncs->init_rkern_b = init_kern_mpi_bcast;
                     ptfuncs->run_rkern_b = run_kern_mpi_bcast;
@@ -411,6 +441,10 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     ptfuncs->check_rkern_b_key = check_key_mpi_bcast;
                     ptfuncs->cleanup_rkern_b = cleanup_kern_mpi_bcast;
                     strcpy(ptopts->rkern_b_name, "mpi_bcast");
+#else
+                    fprintf(stderr, "mpi_bcast needs partes-mpi.x\n");
+                    return PTERR_INVALID_ARGUMENT;
+#endif
                 } else {
                     fprintf(stderr, "Unknown rear kernel for tb: %s\n", argv[i + 1]);
                     return PTERR_INVALID_ARGUMENT;
@@ -447,12 +481,17 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                     pttimers->get_stamp = get_stamp_clock_gettime;
                     strcpy(ptopts->timer_name, "clock_gettime");
                 } else if (strcmp(argv[i + 1], "mpi_wtime") == 0) {
+#ifdef PTOPT_USE_MPI
                     ptopts->timer = TIMER_MPI_WTIME;
                     pttimers->init_timer = init_timer_mpi_wtime;
                     pttimers->tick = tick_mpi_wtime;
                     pttimers->tock = tock_mpi_wtime;
                     pttimers->get_stamp = get_stamp_mpi_wtime;
                     strcpy(ptopts->timer_name, "mpi_wtime");
+#else
+                    fprintf(stderr, "mpi_wtime needs partes-mpi.x\n");
+                    return PTERR_INVALID_ARGUMENT;
+#endif
                 }  else if (strcmp(argv[i + 1], "tsc_asym") == 0) {
                     ptopts->timer = TIMER_TSC_ASYM;
                     pttimers->init_timer = init_timer_tsc_asym;
@@ -528,6 +567,52 @@ parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs,
                 ptopts->cut_p = atof(argv[i + 1]);
                 i++; // Skip the next argument
             }
+        } else if (strcmp(argv[i], "--sync") == 0) {
+            if (i + 1 < argc) {
+                if (strcmp(argv[i + 1], "mpi") == 0) {
+                    ptopts->sync = SYNC_MPI;
+                    strcpy(ptopts->sync_name, "mpi");
+                } else if (strcmp(argv[i + 1], "shm") == 0) {
+                    ptopts->sync = SYNC_SHM;
+                    strcpy(ptopts->sync_name, "shm");
+                } else if (strcmp(argv[i + 1], "time") == 0) {
+                    ptopts->sync = SYNC_TIME;
+                    strcpy(ptopts->sync_name, "time");
+                } else {
+                    fprintf(stderr, "Unknown sync method: %s\n", argv[i + 1]);
+                    return PTERR_INVALID_ARGUMENT;
+                }
+                i++; // Skip the next argument
+            }
+        } else if (strcmp(argv[i], "--period") == 0) {
+            if (i + 1 < argc) {
+                ptopts->period = atol(argv[i + 1]);
+                i++; // Skip the next argument
+            }
+        } else if (strcmp(argv[i], "--output") == 0) {
+            if (i + 1 < argc) {
+                if (strcmp(argv[i + 1], "csv") == 0) {
+                    ptopts->output = OUTPUT_CSV;
+                    strcpy(ptopts->output_name, "csv");
+                } else if (strcmp(argv[i + 1], "mpiio") == 0) {
+                    ptopts->output = OUTPUT_MPIIO;
+                    strcpy(ptopts->output_name, "mpiio");
+                } else {
+                    fprintf(stderr, "Unknown output format: %s\n", argv[i + 1]);
+                    return PTERR_INVALID_ARGUMENT;
+                }
+                i++; // Skip the next argument
+            }
+        } else if (strcmp(argv[i], "--output-file") == 0) {
+            if (i + 1 < argc) {
+                snprintf(ptopts->output_file, sizeof(ptopts->output_file), "%s", argv[i + 1]);
+                i++; // Skip the next argument
+            }
+        } else if (strcmp(argv[i], "--nthreads") == 0) {
+            if (i + 1 < argc) {
+                ptopts->nthread = atoi(argv[i + 1]);
+                i++; // Skip the next argument
+            }
         } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             print_usage(argv);
             return PTERR_EXIT_FLAG;
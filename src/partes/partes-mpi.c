@@ -7,6 +7,7 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <mpi.h>
@@ -14,45 +15,54 @@
 #include <inttypes.h>
 #include "pterr.h"
 #include "partes_types.h"
+#include "ptsync.h"
+#include "ptio.h"
 #include "stat.h"
 
-#ifndef __PTM_NOP
-#define __PTM_NOP __asm__ __volatile__ ("nop");
-#endif
-
-/* Memory fence for different ISAs */
-#if defined(__x86_64__) || defined(__i386__)
-#define __PTM_MFENCE __asm__ __volatile__ ("mfence" ::: "memory");
-#elif defined(__aarch64__) || defined(__arm__)
-#define __PTM_MFENCE __asm__ __volatile__ ("dmb sy" ::: "memory");
-#elif defined(__powerpc__) || defined(__ppc__) || defined(__PPC__)
-#define __PTM_MFENCE __asm__ __volatile__ ("sync" ::: "memory");
-#elif defined(__riscv)
-#define __PTM_MFENCE __asm__ __volatile__ ("fence rw,rw" ::: "memory");
-#elif defined(__s390x__)
-#define __PTM_MFENCE __asm__ __volatile__ ("bcr 15,0" ::: "memory");
-#elif defined(__sparc__)
-#define __PTM_MFENCE __asm__ __volatile__ ("membar #Sync" ::: "memory");
-#elif defined(__alpha__)
-#define __PTM_MFENCE __asm__ __volatile__ ("mb" ::: "memory");
-#elif defined(__ia64__)
-#define __PTM_MFENCE __asm__ __volatile__ ("mf" ::: "memory");
-#else
-/* Fallback to compiler barrier */
-#define __PTM_MFENCE __asm__ __volatile__ ("" ::: "memory");
-#endif
-
 
 extern int get_tspec(int ntest, pt_timer_func_t *pttimers, pt_timer_spec_t *timer_spec);
 extern int parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs, pt_timer_func_t *pttimers, pt_gauge_func_t *ptgauges);
 extern int exp_fit_gpns(int ntest, int64_t tmax, pt_timer_func_t *pttimers, pt_gauge_func_t *ptgauges, double *gpns);
 
+/**
+ * @brief Default slot period of --sync time: the longest untimed iteration of
+ *        ta and tb on any rank, plus a quarter of it and PT_SYNC_MARGIN. The
+ *        keys take PT_SYNC_NWARM more updates, checks have to count them.
+ */
+static int64_t
+measure_period(pt_kern_func_t *ptfuncs, pt_gauge_func_t *ptgauges, int64_t *ngs)
+{
+    int64_t t0, dt_max = 0;
+
+    for (int i = 0; i < PT_SYNC_NWARM; i++) {
+        t0 = pt_sync_now();
+        ptfuncs->run_fkern_a(PT_CALL_ID_TA_FRONT);
+        ptgauges->run_gauge(ngs[0]);
+        ptfuncs->run_rkern_a(PT_CALL_ID_TA_REAR);
+        ptfuncs->update_fkern_a_key(PT_CALL_ID_TA_FRONT);
+        ptfuncs->update_rkern_a_key(PT_CALL_ID_TA_REAR);
+        t0 = pt_sync_now() - t0;
+        dt_max = t0 > dt_max ? t0 : dt_max;
+        t0 = pt_sync_now();
+        ptfuncs->run_fkern_b(PT_CALL_ID_TB_FRONT);
+        ptgauges->run_gauge(ngs[1]);
+        ptfuncs->run_rkern_b(PT_CALL_ID_TB_REAR);
+        ptfuncs->update_fkern_b_key(PT_CALL_ID_TB_FRONT);
+        ptfuncs->update_rkern_b_key(PT_CALL_ID_TB_REAR);
+        t0 = pt_sync_now() - t0;
+        dt_max = t0 > dt_max ? t0 : dt_max;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &dt_max, 1, MPI_INT64_T, MPI_MAX, MPI_COMM_WORLD);
+
+    return dt_max + dt_max / 4 + PT_SYNC_MARGIN;
+}
+
 int 
 main(int argc, char *argv[]) 
 {
     int myrank = 0, nrank = 1, mpi_inited = 0;
     // Measured times and # of gauges
-    int64_t **p_tmet = NULL, **p_tmet_all = NULL, ngs[2] = {0}; 
+    int64_t **p_tmet = NULL, *p_cdf[2] = {NULL, NULL}, ngs[2] = {0}; 
     enum pterr err = PTERR_SUCCESS;
     pt_opts_t ptopts;
     pt_kern_func_t ptfuncs;
@@ -60,6 +70,8 @@ main(int argc, char *argv[])
     pt_gauge_func_t ptgauges;
     pt_timer_spec_t timer_spec;
     pt_gauge_info_t gauge_info;
+    pt_sync_t ptsync;
+    int sync_inited = 0, nwarm = 0;
     // Initialize MPI
     err = MPI_Init(&argc, &argv);
     if (err != MPI_SUCCESS) {
@@ -92,6 +104,7 @@ main(int argc, char *argv[])
             "ns, %" PRIi64 "ns\n", ptopts.ntests, ptopts.ta, ptopts.tb);
         printf("Timer: %s\n", ptopts.timer_name);
         printf("Gauge: %s\n", ptopts.gauge_name);
+        printf("Sync: %s\n", ptopts.sync_name);
         printf("ta flush info:\n");
         printf("Front kernel: %s, size: %zu KiB, real size: %zu KiB\n", 
             ptopts.fkern_a_name, ptopts.fsize_a, ptopts.fsize_real_a);
@@ -137,37 +150,48 @@ main(int argc, char *argv[])
             _ptm_exit_on_error(err, "main:malloc");
         }
     }
-    if (myrank == 0) {
-        p_tmet_all = (int64_t **)malloc(2 * sizeof(int64_t *));
-        if (p_tmet_all == NULL) {
+    for (int i = 0; i < 2; i++) {
+        p_cdf[i] = (int64_t *)malloc(ptopts.ntiles * sizeof(int64_t));
+        if (p_cdf[i] == NULL) {
             err = PTERR_MALLOC_FAILED;
             _ptm_exit_on_error(err, "main:malloc");
         }
-        for (int i = 0; i < 2; i++) {
-            p_tmet_all[i] = NULL;
-            p_tmet_all[i] = (int64_t *)malloc(ptopts.ntests * nrank * sizeof(int64_t));
-            if (p_tmet_all[i] == NULL) {
-                err = PTERR_MALLOC_FAILED;
-                _ptm_exit_on_error(err, "main:malloc");
-            }
-        }
     }
 
     ngs[0] = (int64_t)((double)ptopts.ta * gauge_info.gpns);
     ngs[1] = (int64_t)((double)ptopts.tb * gauge_info.gpns);
 
+    if (ptopts.sync == SYNC_TIME && ptopts.period <= 0) {
+        ptopts.period = measure_period(&ptfuncs, &ptgauges, ngs);
+        nwarm = PT_SYNC_NWARM;
+    }
+    err = pt_sync_init(ptopts.sync, ptopts.period, &ptsync);
+    _ptm_exit_on_error(err, "pt_sync_init");
+    sync_inited = 1;
+
     if (myrank == 0) {
         fflush(stdout);
         printf("t0 = %" PRIi64 ", number of gauges: %" PRIi64 "\n"
             "t1 = %" PRIi64 ", number of gauges: %" PRIi64 "\n", ptopts.ta, ngs[0], ptopts.tb, ngs[1]);
+        if (ptopts.sync == SYNC_TIME) {
+            printf("Slot period: %" PRIi64 "ns\n", ptopts.period);
+        }
     }
 
     MPI_Barrier(MPI_COMM_WORLD);
+    if (ptsync.mode == SYNC_TIME) {
+        pt_sync_start(&ptsync);
+    }
     for (int i = 0; i < ptopts.ntests; i++) {
         __PTM_NOP;
-        MPI_Barrier(MPI_COMM_WORLD);
-        __PTM_MFENCE;
-        MPI_Barrier(MPI_COMM_WORLD);
+        if (ptsync.mode == SYNC_TIME) {
+            pt_sync_wait_slot(&ptsync, i);
+            __PTM_MFENCE;
+        } else {
+            pt_sync_barrier(&ptsync);
+            __PTM_MFENCE;
+            pt_sync_barrier(&ptsync);
+        }
         ptfuncs.run_fkern_a(PT_CALL_ID_TA_FRONT);
         register int64_t t0 = pttimers.tick();
         // __timer_tick_clock_gettime;
@@ -181,9 +205,14 @@ main(int argc, char *argv[])
 
     for (int i = 0; i < ptopts.ntests; i++) {
         __PTM_NOP;
-        MPI_Barrier(MPI_COMM_WORLD);
-        __PTM_MFENCE;
-        MPI_Barrier(MPI_COMM_WORLD);
+        if (ptsync.mode == SYNC_TIME) {
+            pt_sync_wait_slot(&ptsync, i + ptopts.ntests);
+            __PTM_MFENCE;
+        } else {
+            pt_sync_barrier(&ptsync);
+            __PTM_MFENCE;
+            pt_sync_barrier(&ptsync);
+        }
         ptfuncs.run_fkern_b(PT_CALL_ID_TB_FRONT);
         register int64_t t0 = pttimers.tick();
         // __timer_tick_clock_gettime;
@@ -194,100 +223,59 @@ main(int argc, char *argv[])
         ptfuncs.update_fkern_b_key(PT_CALL_ID_TB_FRONT);
         ptfuncs.update_rkern_b_key(PT_CALL_ID_TB_REAR);
     }
+    if (ptsync.mode == SYNC_TIME) {
+        int64_t nmiss = 0, nslot = 2 * ptopts.ntests * nrank;
+        MPI_Allreduce(&ptsync.nmiss, &nmiss, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+        if (myrank == 0) {
+            printf("Late slot starts: %" PRIi64 " of %" PRIi64 "\n", nmiss, nslot);
+        }
+        if ((double)nmiss > PT_SYNC_MAX_MISS * (double)nslot) {
+            err = PTERR_SYNC_LATE;
+        }
+        _ptm_exit_on_error(err, "pt_sync_wait_slot");
+    }
     double perc_gap_ta_front, perc_gap_ta_rear, perc_gap_tb_front, perc_gap_tb_rear;
     
-    ptfuncs.check_fkern_a_key(PT_CALL_ID_TA_FRONT, ptopts.ntests, &perc_gap_ta_front);
+    ptfuncs.check_fkern_a_key(PT_CALL_ID_TA_FRONT, ptopts.ntests + nwarm, &perc_gap_ta_front);
     if (myrank == 0) {
         printf("TA Front kernel percentage gap: %f%%\n", perc_gap_ta_front);
     }
-    ptfuncs.check_rkern_a_key(PT_CALL_ID_TA_REAR, ptopts.ntests, &perc_gap_ta_rear);
+    ptfuncs.check_rkern_a_key(PT_CALL_ID_TA_REAR, ptopts.ntests + nwarm, &perc_gap_ta_rear);
     if (myrank == 0) {
         printf("TA Rear kernel percentage gap: %f%%\n", perc_gap_ta_rear);
     }
-    ptfuncs.check_fkern_b_key(PT_CALL_ID_TB_FRONT, ptopts.ntests, &perc_gap_tb_front);
+    ptfuncs.check_fkern_b_key(PT_CALL_ID_TB_FRONT, ptopts.ntests + nwarm, &perc_gap_tb_front);
     if (myrank == 0) {
         printf("TB Front kernel percentage gap: %.6f%%\n", perc_gap_tb_front);
     }
-    ptfuncs.check_rkern_b_key(PT_CALL_ID_TB_REAR, ptopts.ntests, &perc_gap_tb_rear);
+    ptfuncs.check_rkern_b_key(PT_CALL_ID_TB_REAR, ptopts.ntests + nwarm, &perc_gap_tb_rear);
     if (myrank == 0) {
         printf("TB Rear kernel percentage gap: %.6f%%\n", perc_gap_tb_rear);
     }
     /* Step 4: Calculate Wasserstein distance */
+    // The tiles of all ranks' samples are found without gathering them on rank 0.
     for (int i = 0; i < 2; i++) {
-        if (myrank == 0) {
-            MPI_Gather(p_tmet[i], ptopts.ntests, MPI_INT64_T, p_tmet_all[i], 
-                ptopts.ntests, MPI_INT64_T, 0, MPI_COMM_WORLD);
-        } else {
-            MPI_Gather(p_tmet[i], ptopts.ntests, MPI_INT64_T, NULL, 
-                0, MPI_INT64_T, 0, MPI_COMM_WORLD);
-        }
+        err = calc_cdf_i64_mpi(p_tmet[i], ptopts.ntests, p_cdf[i], ptopts.ntiles, MPI_COMM_WORLD);
+        _ptm_exit_on_error(err, "calc_cdf_i64_mpi");
     }
     if (myrank == 0) {
-        int64_t p_cdf[2][ptopts.ntiles];
-        double w;
-        FILE *fp_ta_cdf = NULL, *fp_tb_cdf = NULL;
-
-
-        calc_cdf_i64(p_tmet_all[0], ptopts.ntests * nrank, p_cdf[0], ptopts.ntiles);
-        calc_cdf_i64(p_tmet_all[1], ptopts.ntests * nrank, p_cdf[1], ptopts.ntiles);
-        calc_w(p_cdf[0], p_cdf[1], ptopts.ntiles, ptopts.cut_p, &w);
-        printf("Percentage cut: %f\nTime gap: %" PRIi64 "ns\n", ptopts.cut_p, ptopts.tb - ptopts.ta);
-        printf("Quantile, W(Ta), W(Tb), W(Tb)-W(Ta)\n");
-        printf("0, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
-            p_cdf[0][0], p_cdf[1][0], p_cdf[1][0] - p_cdf[0][0]);
-        printf("50, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
-            p_cdf[0][(int)(ptopts.ntiles * 0.5)], p_cdf[1][(int)(ptopts.ntiles * 0.5)], p_cdf[1][(int)(ptopts.ntiles * 0.5)] - p_cdf[0][(int)(ptopts.ntiles * 0.5)]);
-        printf("75, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
-            p_cdf[0][(int)(ptopts.ntiles * 0.75)], p_cdf[1][(int)(ptopts.ntiles * 0.75)], p_cdf[1][(int)(ptopts.ntiles * 0.75)] - p_cdf[0][(int)(ptopts.ntiles * 0.75)]);
-        printf("90, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
-            p_cdf[0][(int)(ptopts.ntiles * 0.9)], p_cdf[1][(int)(ptopts.ntiles * 0.9)], p_cdf[1][(int)(ptopts.ntiles * 0.9)] - p_cdf[0][(int)(ptopts.ntiles * 0.9)]);
-        printf("95, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
-            p_cdf[0][(int)(ptopts.ntiles * 0.95)], p_cdf[1][(int)(ptopts.ntiles * 0.95)], p_cdf[1][(int)(ptopts.ntiles * 0.95)] - p_cdf[0][(int)(ptopts.ntiles * 0.95)]);
-        printf("99, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n", 
-            p_cdf[0][(int)(ptopts.ntiles * 0.99)], p_cdf[1][(int)(ptopts.ntiles * 0.99)], p_cdf[1][(int)(ptopts.ntiles * 0.99)] - p_cdf[0][(int)(ptopts.ntiles * 0.99)]);
-        printf("100, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
-            p_cdf[0][ptopts.ntiles-1], p_cdf[1][ptopts.ntiles-1], p_cdf[1][ptopts.ntiles-1] - p_cdf[0][ptopts.ntiles-1]);
-        printf("Wasserstein distance: %f\n", w);
-
-        fp_ta_cdf = fopen("partes_ta_cdf.csv", "w");
-        fp_tb_cdf = fopen("partes_tb_cdf.csv", "w");
-        if (!fp_ta_cdf || !fp_tb_cdf) {
-            err = PTERR_FILE_OPEN_FAILED;
-            _ptm_exit_on_error(err, "main:fopen");
-        }
-        for (int i = 0; i < ptopts.ntiles; i++) {
-            fprintf(fp_ta_cdf, "%" PRIi64 "\n", p_cdf[0][i]);
-            fprintf(fp_tb_cdf, "%" PRIi64 "\n", p_cdf[1][i]);
-        }
-        fclose(fp_ta_cdf);
-        fclose(fp_tb_cdf);
-        fp_ta_cdf = NULL;
-        fp_tb_cdf = NULL;
-    }
-    FILE *fp_a = NULL, *fp_b = NULL;
-    char fp_a_name[1024], fp_b_name[1024];
-    sprintf(fp_a_name, "partes_ta_r%d.csv", myrank);
-    sprintf(fp_b_name, "partes_tb_r%d.csv", myrank);
-    fp_a = fopen(fp_a_name, "w");
-    if (!fp_a) {
-        err = PTERR_FILE_OPEN_FAILED;
-        _ptm_exit_on_error(err, "main:fopen");
-    }
-    fp_b = fopen(fp_b_name, "w");
-    if (!fp_b) {
-        err = PTERR_FILE_OPEN_FAILED;
-        fclose(fp_a);
-        fp_a = NULL;
-        _ptm_exit_on_error(err, "main:fopen");
+        err = pt_report_w(&ptopts, p_cdf);
+        _ptm_exit_on_error(err, "pt_report_w");
     }
-    for (int i = 0; i < ptopts.ntests; i++) {
-        fprintf(fp_a, "%" PRIi64 "\n", p_tmet[0][i]);
-        fprintf(fp_b, "%" PRIi64 "\n", p_tmet[1][i]);
+    if (ptopts.output == OUTPUT_MPIIO) {
+        pt_raw_header_t hdr = {PT_RAW_MAGIC, ptopts.ntests, nrank, ptopts.ta, ptopts.tb, "", "",
+                               gauge_info.gpns};
+        strcpy(hdr.timer, ptopts.timer_name);
+        strcpy(hdr.gauge, ptopts.gauge_name);
+        err = pt_write_raw_mpiio(ptopts.output_file, &hdr, gauge_info.gpns, p_tmet, MPI_COMM_WORLD);
+        _ptm_exit_on_error(err, "pt_write_raw_mpiio");
+        if (myrank == 0) {
+            printf("Raw samples written to %s\n", ptopts.output_file);
+        }
+    } else {
+        err = pt_write_raw_csv(myrank, p_tmet, ptopts.ntests);
+        _ptm_exit_on_error(err, "pt_write_raw_csv");
     }
-    fclose(fp_a);
-    fclose(fp_b);
-    fp_a = NULL;
-    fp_b = NULL;
     MPI_Barrier(MPI_COMM_WORLD);
 
 EXIT:
@@ -302,19 +290,17 @@ EXIT:
         free(p_tmet);
         p_tmet = NULL;
     }
-    if (myrank == 0) {
-        if (p_tmet_all) {
-            for (int i = 0; i < 2; i++) {
-                if (p_tmet_all[i]) {
-                    free(p_tmet_all[i]);
-                    p_tmet_all[i] = NULL;
-                }
-            }
-            free(p_tmet_all);
-            p_tmet_all = NULL;
+    for (int i = 0; i < 2; i++) {
+        if (p_cdf[i]) {
+            free(p_cdf[i]);
+            p_cdf[i] = NULL;
         }
     }
 
+    if (sync_inited) {
+        pt_sync_free(&ptsync);
+    }
+
     /* Cleanup kernels */
     ptfuncs.cleanup_fkern_a(PT_CALL_ID_TA_FRONT);
     ptfuncs.cleanup_rkern_a(PT_CALL_ID_TA_REAR);
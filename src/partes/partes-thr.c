@@ -0,0 +1,289 @@
+/**
+ * @file partes-thr.c
+ * @brief: Run the partes gauges in pinned threads of one process, without mpirun.
+ *         Each thread plays the part of a rank in partes-mpi.x.
+ */
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "pterr.h"
+#include "partes_types.h"
+#include "ptsync.h"
+#include "ptio.h"
+#include "stat.h"
+
+
+extern int parse_ptargs(int argc, char *argv[], pt_opts_t *ptopts, pt_kern_func_t *ptfuncs, pt_timer_func_t *pttimers, pt_gauge_func_t *ptgauges);
+extern int exp_fit_gpns(int ntest, int64_t tmax, pt_timer_func_t *pttimers, pt_gauge_func_t *ptgauges, double *gpns);
+
+typedef struct {
+    pt_opts_t ptopts;
+    pt_kern_func_t ptfuncs;
+    pt_timer_func_t pttimers;
+    pt_gauge_func_t ptgauges;
+    pt_spin_bar_t *bar;
+    int nthread;
+    int err;                // First error of any thread
+    int64_t *p_tmet[2];     // ntests samples of ta and tb of each thread, in thread order
+} pt_thr_ctx_t;
+
+typedef struct {
+    pt_thr_ctx_t *ctx;
+    pthread_t th;
+    int tid, cpu;
+    double gpns;
+    double perc_gap[4];     // ta front, ta rear, tb front, tb rear
+} pt_thr_arg_t;
+
+static pt_thr_arg_t *thr_args = NULL;
+
+/**
+ * @brief Body of one thread: pin it, set up its own kernels and gpns, then run
+ *        the ta and tb loops of partes-mpi.x between spin barriers.
+ */
+static void *
+thr_run(void *p)
+{
+    pt_thr_arg_t *arg = (pt_thr_arg_t *)p;
+    pt_thr_ctx_t *ctx = arg->ctx;
+    pt_opts_t *ptopts = &ctx->ptopts;
+    pt_kern_func_t *ptfuncs = &ctx->ptfuncs;
+    pt_timer_func_t *pttimers = &ctx->pttimers;
+    pt_gauge_func_t *ptgauges = &ctx->ptgauges;
+    int err = PTERR_SUCCESS;
+    int64_t sense = 0, ngs[2];
+    int64_t *p_tmet[2];
+    size_t fsize_real_a, rsize_real_a, fsize_real_b, rsize_real_b;
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(arg->cpu, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) {
+        err = PTERR_THREAD_FAILED;
+        _ptm_exit_on_error(err, "pthread_setaffinity_np");
+    }
+
+    /* Kernel data is thread local, each thread allocates its own on its core */
+    err = ptfuncs->init_fkern_a(ptopts->fsize_a, PT_CALL_ID_TA_FRONT, &fsize_real_a);
+    _ptm_exit_on_error(err, "init_fkern_a");
+    err = ptfuncs->init_rkern_a(ptopts->rsize_a, PT_CALL_ID_TA_REAR, &rsize_real_a);
+    _ptm_exit_on_error(err, "init_rkern_a");
+    err = ptfuncs->init_fkern_b(ptopts->fsize_b, PT_CALL_ID_TB_FRONT, &fsize_real_b);
+    _ptm_exit_on_error(err, "init_fkern_b");
+    err = ptfuncs->init_rkern_b(ptopts->rsize_b, PT_CALL_ID_TB_REAR, &rsize_real_b);
+    _ptm_exit_on_error(err, "init_rkern_b");
+    if (arg->tid == 0) {
+        ptopts->fsize_real_a = fsize_real_a;
+        ptopts->rsize_real_a = rsize_real_a;
+        ptopts->fsize_real_b = fsize_real_b;
+        ptopts->rsize_real_b = rsize_real_b;
+    }
+
+    err = pttimers->init_timer();
+    _ptm_exit_on_error(err, "init_timer");
+    err = exp_fit_gpns(100, 100000000LL, pttimers, ptgauges, &arg->gpns);
+    _ptm_exit_on_error(err, "exp_fit_gpns");
+
+EXIT:
+    if (err != PTERR_SUCCESS) {
+        int expected = PTERR_SUCCESS;
+        __atomic_compare_exchange_n(&ctx->err, &expected, err, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    // Every thread reaches this barrier, so a failed one cannot leave the others spinning.
+    pt_spin_bar_wait(ctx->bar, ctx->nthread, &sense);
+    if (__atomic_load_n(&ctx->err, __ATOMIC_ACQUIRE) != PTERR_SUCCESS) {
+        goto CLEANUP;
+    }
+
+    ngs[0] = (int64_t)((double)ptopts->ta * arg->gpns);
+    ngs[1] = (int64_t)((double)ptopts->tb * arg->gpns);
+    p_tmet[0] = ctx->p_tmet[0] + (size_t)arg->tid * ptopts->ntests;
+    p_tmet[1] = ctx->p_tmet[1] + (size_t)arg->tid * ptopts->ntests;
+
+    if (arg->tid == 0) {
+        printf("ta flush info:\n");
+        printf("Front kernel: %s, size: %zu KiB, real size: %zu KiB\n",
+            ptopts->fkern_a_name, ptopts->fsize_a, ptopts->fsize_real_a);
+        printf("Rear kernel: %s, size: %zu KiB, real size: %zu KiB\n",
+            ptopts->rkern_a_name, ptopts->rsize_a, ptopts->rsize_real_a);
+        printf("tb flush info:\n");
+        printf("Front kernel: %s, size: %zu KiB, real size: %zu KiB\n",
+            ptopts->fkern_b_name, ptopts->fsize_b, ptopts->fsize_real_b);
+        printf("Rear kernel: %s, size: %zu KiB, real size: %zu KiB\n",
+            ptopts->rkern_b_name, ptopts->rsize_b, ptopts->rsize_real_b);
+        for (int t = 0; t < ctx->nthread; t++) {
+            printf("[Thread %d, CPU %d] Gauge info: gpns=%f\n", t, thr_args[t].cpu, thr_args[t].gpns);
+        }
+        printf("t0 = %" PRIi64 ", number of gauges: %" PRIi64 "\n"
+            "t1 = %" PRIi64 ", number of gauges: %" PRIi64 "\n", ptopts->ta, ngs[0], ptopts->tb, ngs[1]);
+        fflush(stdout);
+    }
+    pt_spin_bar_wait(ctx->bar, ctx->nthread, &sense);
+
+    for (int i = 0; i < ptopts->ntests; i++) {
+        __PTM_NOP;
+        pt_spin_bar_wait(ctx->bar, ctx->nthread, &sense);
+        __PTM_MFENCE;
+        pt_spin_bar_wait(ctx->bar, ctx->nthread, &sense);
+        ptfuncs->run_fkern_a(PT_CALL_ID_TA_FRONT);
+        register int64_t t0 = pttimers->tick();
+        ptgauges->run_gauge(ngs[0]);
+        p_tmet[0][i] = pttimers->tock() - t0;
+        ptfuncs->run_rkern_a(PT_CALL_ID_TA_REAR);
+        ptfuncs->update_fkern_a_key(PT_CALL_ID_TA_FRONT);
+        ptfuncs->update_rkern_a_key(PT_CALL_ID_TA_REAR);
+    }
+
+    for (int i = 0; i < ptopts->ntests; i++) {
+        __PTM_NOP;
+        pt_spin_bar_wait(ctx->bar, ctx->nthread, &sense);
+        __PTM_MFENCE;
+        pt_spin_bar_wait(ctx->bar, ctx->nthread, &sense);
+        ptfuncs->run_fkern_b(PT_CALL_ID_TB_FRONT);
+        register int64_t t0 = pttimers->tick();
+        ptgauges->run_gauge(ngs[1]);
+        p_tmet[1][i] = pttimers->tock() - t0;
+        ptfuncs->run_rkern_b(PT_CALL_ID_TB_REAR);
+        ptfuncs->update_fkern_b_key(PT_CALL_ID_TB_FRONT);
+        ptfuncs->update_rkern_b_key(PT_CALL_ID_TB_REAR);
+    }
+
+    ptfuncs->check_fkern_a_key(PT_CALL_ID_TA_FRONT, ptopts->ntests, &arg->perc_gap[0]);
+    ptfuncs->check_rkern_a_key(PT_CALL_ID_TA_REAR, ptopts->ntests, &arg->perc_gap[1]);
+    ptfuncs->check_fkern_b_key(PT_CALL_ID_TB_FRONT, ptopts->ntests, &arg->perc_gap[2]);
+    ptfuncs->check_rkern_b_key(PT_CALL_ID_TB_REAR, ptopts->ntests, &arg->perc_gap[3]);
+
+CLEANUP:
+    ptfuncs->cleanup_fkern_a(PT_CALL_ID_TA_FRONT);
+    ptfuncs->cleanup_rkern_a(PT_CALL_ID_TA_REAR);
+    ptfuncs->cleanup_fkern_b(PT_CALL_ID_TB_FRONT);
+    ptfuncs->cleanup_rkern_b(PT_CALL_ID_TB_REAR);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int nthread = 0, gauge_inited = 0;
+    int64_t *p_cdf[2] = {NULL, NULL};
+    enum pterr err = PTERR_SUCCESS;
+    pt_thr_ctx_t ctx;
+    cpu_set_t cpuset;
+    int cpus[CPU_SETSIZE], ncpu = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    err = parse_ptargs(argc, argv, &ctx.ptopts, &ctx.ptfuncs, &ctx.pttimers, &ctx.ptgauges);
+    _ptm_exit_on_error(err, "parse_ptargs");
+    if (ctx.ptopts.sync == SYNC_TIME || ctx.ptopts.output == OUTPUT_MPIIO) {
+        fprintf(stderr, "--sync time and --output mpiio need partes-mpi.x\n");
+        err = PTERR_INVALID_ARGUMENT;
+        goto EXIT;
+    }
+
+    /* Threads are pinned to the CPUs this process may run on, in order */
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) != 0) {
+        err = PTERR_THREAD_FAILED;
+        _ptm_exit_on_error(err, "sched_getaffinity");
+    }
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &cpuset)) {
+            cpus[ncpu++] = c;
+        }
+    }
+    nthread = ctx.ptopts.nthread > 0 ? ctx.ptopts.nthread : ncpu;
+    if (nthread > ncpu) {
+        fprintf(stderr, "Error: %d threads requested, only %d CPUs allowed\n", nthread, ncpu);
+        err = PTERR_INVALID_ARGUMENT;
+        goto EXIT;
+    }
+    ctx.nthread = nthread;
+
+    err = ctx.ptgauges.init_gauge();
+    _ptm_exit_on_error(err, "init_gauge");
+    gauge_inited = 1;
+
+    printf("Repeat %" PRIi64 " runtime measurements, target gauge time: %" PRIi64
+        "ns, %" PRIi64 "ns\n", ctx.ptopts.ntests, ctx.ptopts.ta, ctx.ptopts.tb);
+    printf("Timer: %s\n", ctx.ptopts.timer_name);
+    printf("Gauge: %s\n", ctx.ptopts.gauge_name);
+    printf("Threads: %d\n", nthread);
+    fflush(stdout);
+
+    if (posix_memalign((void **)&ctx.bar, PT_CACHE_LINE, sizeof(pt_spin_bar_t)) != 0) {
+        ctx.bar = NULL;
+        err = PTERR_MALLOC_FAILED;
+        _ptm_exit_on_error(err, "main:posix_memalign");
+    }
+    pt_spin_bar_init(ctx.bar, nthread);
+    for (int i = 0; i < 2; i++) {
+        ctx.p_tmet[i] = (int64_t *)malloc(ctx.ptopts.ntests * nthread * sizeof(int64_t));
+        p_cdf[i] = (int64_t *)malloc(ctx.ptopts.ntiles * sizeof(int64_t));
+        if (ctx.p_tmet[i] == NULL || p_cdf[i] == NULL) {
+            err = PTERR_MALLOC_FAILED;
+            _ptm_exit_on_error(err, "main:malloc");
+        }
+    }
+    thr_args = (pt_thr_arg_t *)calloc(nthread, sizeof(pt_thr_arg_t));
+    if (thr_args == NULL) {
+        err = PTERR_MALLOC_FAILED;
+        _ptm_exit_on_error(err, "main:malloc");
+    }
+
+    /* Step 1-3: Fit gpns and run the timing error sensor in every thread */
+    for (int t = 0; t < nthread; t++) {
+        thr_args[t].ctx = &ctx;
+        thr_args[t].tid = t;
+        thr_args[t].cpu = cpus[t];
+        if (pthread_create(&thr_args[t].th, NULL, thr_run, &thr_args[t]) != 0) {
+            // Threads already started would wait forever for the missing ones.
+            fprintf(stderr, "[ERROR] pthread_create failed for thread %d\n", t);
+            exit(PTERR_THREAD_FAILED);
+        }
+    }
+    for (int t = 0; t < nthread; t++) {
+        pthread_join(thr_args[t].th, NULL);
+    }
+    err = ctx.err;
+    _ptm_exit_on_error(err, "thr_run");
+
+    printf("TA Front kernel percentage gap: %f%%\n", thr_args[0].perc_gap[0]);
+    printf("TA Rear kernel percentage gap: %f%%\n", thr_args[0].perc_gap[1]);
+    printf("TB Front kernel percentage gap: %.6f%%\n", thr_args[0].perc_gap[2]);
+    printf("TB Rear kernel percentage gap: %.6f%%\n", thr_args[0].perc_gap[3]);
+
+    /* Raw samples go first, calc_cdf_i64 sorts them in place */
+    for (int t = 0; t < nthread; t++) {
+        int64_t *p_tmet[2] = {ctx.p_tmet[0] + (size_t)t * ctx.ptopts.ntests,
+                              ctx.p_tmet[1] + (size_t)t * ctx.ptopts.ntests};
+        err = pt_write_raw_csv(t, p_tmet, ctx.ptopts.ntests);
+        _ptm_exit_on_error(err, "pt_write_raw_csv");
+    }
+
+    /* Step 4: Calculate Wasserstein distance */
+    calc_cdf_i64(ctx.p_tmet[0], ctx.ptopts.ntests * nthread, p_cdf[0], ctx.ptopts.ntiles);
+    calc_cdf_i64(ctx.p_tmet[1], ctx.ptopts.ntests * nthread, p_cdf[1], ctx.ptopts.ntiles);
+    err = pt_report_w(&ctx.ptopts, p_cdf);
+    _ptm_exit_on_error(err, "pt_report_w");
+
+EXIT:
+    for (int i = 0; i < 2; i++) {
+        free(ctx.p_tmet[i]);
+        free(p_cdf[i]);
+    }
+    free(ctx.bar);
+    free(thr_args);
+    thr_args = NULL;
+    if (gauge_inited) {
+        ctx.ptgauges.cleanup_gauge();
+    }
+    return err;
+}
@@ -20,12 +20,13 @@
 #define PT_VAR_MAX_NSTEP 25 // Maximum number of steps to calculate variance
 
 typedef struct {
-    int64_t ta, tb, ntests;
+    int64_t ta, tb, ntests, period;
     size_t fsize_a, rsize_a, fsize_b, rsize_b;
     size_t fsize_real_a, rsize_real_a, fsize_real_b, rsize_real_b;
     double cut_p;
-    int fkern_a, fkern_b, rkern_a, rkern_b, timer, gauge, ntiles;
+    int fkern_a, fkern_b, rkern_a, rkern_b, timer, gauge, ntiles, sync, output, nthread;
     char fkern_a_name[128], fkern_b_name[128], rkern_a_name[128], rkern_b_name[128], timer_name[128], gauge_name[128];
+    char sync_name[128], output_name[128], output_file[1024];
 } pt_opts_t;
 
 typedef struct {
@@ -8,7 +8,9 @@
 #include "pterr.h"
 #include <stdarg.h>
 #include <stdio.h>
+#ifndef PTOPT_USE_THREADS
 #include <mpi.h>
+#endif
 
 /**
  * @brief Get string representation of error code
@@ -35,11 +37,20 @@ const char *get_pterr_str(enum pterr err) {
             return "File open failed";
         case PTERR_KEY_CHECK_FAILED:
             return "Key check failed";
+        case PTERR_TIMER_INIT_FAILED:
+            return "Timer initialization failed";
+        case PTERR_MPI_FAILED:
+            return "MPI call failed";
+        case PTERR_THREAD_FAILED:
+            return "Thread creation or pinning failed";
+        case PTERR_SYNC_LATE:
+            return "Too many late slot starts, raise --period";
         default:
             return "Unknown error";
     }
 }
 
+#ifndef PTOPT_USE_THREADS
 /**
  * @brief Ordered MPI printf
  * @param myrank: The rank of the current process
@@ -75,4 +86,5 @@ pt_mpi_printf(int myrank, int nrank, const char *format, ...) {
     }
 
     return;
-}
\ No newline at end of file
+}
+#endif
@@ -16,11 +16,23 @@ enum pterr {
     PTERR_MISSING_ARGUMENT = 6,
     PTERR_FILE_OPEN_FAILED = 7,
     PTERR_KEY_CHECK_FAILED = 8,
-    PTERR_TIMER_INIT_FAILED = 9
+    PTERR_TIMER_INIT_FAILED = 9,
+    PTERR_MPI_FAILED = 10,
+    PTERR_THREAD_FAILED = 11,
+    PTERR_SYNC_LATE = 12
 };
 
+/* Kernel data is per thread in partes-thr.x, each thread initializes its own kernels */
+#ifdef PTOPT_USE_THREADS
+#define __PTM_TLS __thread
+#else
+#define __PTM_TLS
+#endif
+
 const char *get_pterr_str(enum pterr err);
+#ifndef PTOPT_USE_THREADS
 void pt_mpi_printf(int myrank, int nrank, const char *format, ...);
+#endif
 
 #define _ptm_return_on_error(err, fname) \
     if (err != PTERR_SUCCESS) {                             \
@@ -0,0 +1,165 @@
+/**
+ * @file ptio.c
+ * @brief: Output of partes results and raw measurements.
+ */
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "pterr.h"
+#include "partes_types.h"
+#include "stat.h"
+#include "ptio.h"
+
+/**
+ * @brief Print the quantiles of the ta and tb distributions and their
+ *        Wasserstein distance, and write the tiles to partes_<ta/tb>_cdf.csv.
+ * @param p_cdf ptopts->ntiles tiles of ta and of tb.
+ */
+int
+pt_report_w(pt_opts_t *ptopts, int64_t **p_cdf)
+{
+    int err = PTERR_SUCCESS;
+    double w;
+    FILE *fp_ta_cdf = NULL, *fp_tb_cdf = NULL;
+
+    calc_w(p_cdf[0], p_cdf[1], ptopts->ntiles, ptopts->cut_p, &w);
+    printf("Percentage cut: %f\nTime gap: %" PRIi64 "ns\n", ptopts->cut_p, ptopts->tb - ptopts->ta);
+    printf("Quantile, W(Ta), W(Tb), W(Tb)-W(Ta)\n");
+    printf("0, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
+        p_cdf[0][0], p_cdf[1][0], p_cdf[1][0] - p_cdf[0][0]);
+    printf("50, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
+        p_cdf[0][(int)(ptopts->ntiles * 0.5)], p_cdf[1][(int)(ptopts->ntiles * 0.5)], p_cdf[1][(int)(ptopts->ntiles * 0.5)] - p_cdf[0][(int)(ptopts->ntiles * 0.5)]);
+    printf("75, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
+        p_cdf[0][(int)(ptopts->ntiles * 0.75)], p_cdf[1][(int)(ptopts->ntiles * 0.75)], p_cdf[1][(int)(ptopts->ntiles * 0.75)] - p_cdf[0][(int)(ptopts->ntiles * 0.75)]);
+    printf("90, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
+        p_cdf[0][(int)(ptopts->ntiles * 0.9)], p_cdf[1][(int)(ptopts->ntiles * 0.9)], p_cdf[1][(int)(ptopts->ntiles * 0.9)] - p_cdf[0][(int)(ptopts->ntiles * 0.9)]);
+    printf("95, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
+        p_cdf[0][(int)(ptopts->ntiles * 0.95)], p_cdf[1][(int)(ptopts->ntiles * 0.95)], p_cdf[1][(int)(ptopts->ntiles * 0.95)] - p_cdf[0][(int)(ptopts->ntiles * 0.95)]);
+    printf("99, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n", 
+        p_cdf[0][(int)(ptopts->ntiles * 0.99)], p_cdf[1][(int)(ptopts->ntiles * 0.99)], p_cdf[1][(int)(ptopts->ntiles * 0.99)] - p_cdf[0][(int)(ptopts->ntiles * 0.99)]);
+    printf("100, %" PRIi64 ", %" PRIi64 ", %" PRIi64 "\n",
+        p_cdf[0][ptopts->ntiles-1], p_cdf[1][ptopts->ntiles-1], p_cdf[1][ptopts->ntiles-1] - p_cdf[0][ptopts->ntiles-1]);
+    printf("Wasserstein distance: %f\n", w);
+
+    fp_ta_cdf = fopen("partes_ta_cdf.csv", "w");
+    fp_tb_cdf = fopen("partes_tb_cdf.csv", "w");
+    if (!fp_ta_cdf || !fp_tb_cdf) {
+        err = PTERR_FILE_OPEN_FAILED;
+        _ptm_exit_on_error(err, "pt_report_w");
+    }
+    for (int i = 0; i < ptopts->ntiles; i++) {
+        fprintf(fp_ta_cdf, "%" PRIi64 "\n", p_cdf[0][i]);
+        fprintf(fp_tb_cdf, "%" PRIi64 "\n", p_cdf[1][i]);
+    }
+
+EXIT:
+    if (fp_ta_cdf) {
+        fclose(fp_ta_cdf);
+    }
+    if (fp_tb_cdf) {
+        fclose(fp_tb_cdf);
+    }
+    return err;
+
+}
+
+/**
+ * @brief Write the ta and tb samples of one rank or thread to
+ *        partes_<ta/tb>_r<id>.csv.
+ */
+int
+pt_write_raw_csv(int id, int64_t **p_tmet, int64_t ntests)
+{
+    int err = PTERR_SUCCESS;
+    FILE *fp_a = NULL, *fp_b = NULL;
+    char fp_a_name[1024], fp_b_name[1024];
+
+    sprintf(fp_a_name, "partes_ta_r%d.csv", id);
+    sprintf(fp_b_name, "partes_tb_r%d.csv", id);
+    fp_a = fopen(fp_a_name, "w");
+    fp_b = fopen(fp_b_name, "w");
+    if (!fp_a || !fp_b) {
+        err = PTERR_FILE_OPEN_FAILED;
+        _ptm_exit_on_error(err, "pt_write_raw_csv");
+    }
+    for (int64_t i = 0; i < ntests; i++) {
+        fprintf(fp_a, "%" PRIi64 "\n", p_tmet[0][i]);
+        fprintf(fp_b, "%" PRIi64 "\n", p_tmet[1][i]);
+    }
+
+EXIT:
+    if (fp_a) {
+        fclose(fp_a);
+    }
+    if (fp_b) {
+        fclose(fp_b);
+    }
+    return err;
+}
+
+#ifdef PTOPT_USE_MPI
+
+/**
+ * @brief Write the ta and tb samples of every rank in comm to one file. Rank 0
+ *        writes the header, then every rank its entry of the rank table, its ta
+ *        and its tb samples in three collective writes. The error is reduced
+ *        over comm, so either every rank returns it or none does.
+ * @param hdr Header of rank 0, ignored on the other ranks.
+ * @param gpns Gauges per ns of the calling rank.
+ * @param p_tmet ta and tb arrays of hdr->ntests samples.
+ * @return PTERR_SUCCESS, PTERR_FILE_OPEN_FAILED or PTERR_MPI_FAILED.
+ */
+int
+pt_write_raw_mpiio(const char *fpath, const pt_raw_header_t *hdr, double gpns,
+                   int64_t **p_tmet, MPI_Comm comm)
+{
+    int myrank, nrank, err = PTERR_SUCCESS;
+    int64_t ntests = hdr->ntests;
+    MPI_File fh;
+    MPI_Offset off_tab, off_dat;
+    pt_raw_rank_t ent;
+
+    MPI_Comm_rank(comm, &myrank);
+    MPI_Comm_size(comm, &nrank);
+    if (MPI_File_open(comm, fpath, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                      &fh) != MPI_SUCCESS) {
+        err = PTERR_FILE_OPEN_FAILED;
+        goto EXIT;
+    }
+    MPI_File_set_size(fh, 0);
+
+    off_tab = (MPI_Offset)sizeof(pt_raw_header_t) + (MPI_Offset)myrank * sizeof(pt_raw_rank_t);
+    off_dat = (MPI_Offset)sizeof(pt_raw_header_t) + (MPI_Offset)nrank * sizeof(pt_raw_rank_t)
+            + (MPI_Offset)myrank * 2 * ntests * sizeof(int64_t);
+    ent.off = (int64_t)off_dat;
+    ent.gpns = gpns;
+
+    if (myrank == 0) {
+        if (MPI_File_write_at(fh, 0, hdr, sizeof(pt_raw_header_t), MPI_BYTE,
+                              MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+            err = PTERR_MPI_FAILED;
+        }
+    }
+    if (MPI_File_write_at_all(fh, off_tab, &ent, sizeof(pt_raw_rank_t), MPI_BYTE,
+                              MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+        err = PTERR_MPI_FAILED;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (MPI_File_write_at_all(fh, off_dat + (MPI_Offset)i * ntests * sizeof(int64_t), p_tmet[i],
+                                  (int)ntests, MPI_INT64_T, MPI_STATUS_IGNORE) != MPI_SUCCESS) {
+            err = PTERR_MPI_FAILED;
+        }
+    }
+    MPI_File_close(&fh);
+
+EXIT:
+    // Rank 0 alone writes the header: agree on the error before the callers branch on it.
+    MPI_Allreduce(MPI_IN_PLACE, &err, 1, MPI_INT, MPI_MAX, comm);
+    return err;
+}
+
+#endif
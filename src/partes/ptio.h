@@ -0,0 +1,49 @@
+/**
+ * @file ptio.h
+ * @brief: Output of partes results and raw measurements.
+ */
+#ifndef PTIO_H
+#define PTIO_H
+
+#include <stdint.h>
+#include "partes_types.h"
+
+#ifdef PTOPT_USE_MPI
+#include <mpi.h>
+#endif
+
+#define PT_RAW_MAGIC "PTRAW01"
+
+enum output_name {
+    OUTPUT_CSV = 0,     // partes_<ta/tb>_r<rank>.csv from every rank
+    OUTPUT_MPIIO        // One binary file written with MPI_File_write_at_all
+};
+
+/**
+ * Layout of the binary file, in the byte order of the writer:
+ *   pt_raw_header_t
+ *   pt_raw_rank_t[nrank]
+ *   for each rank: int64_t ta[ntests], then int64_t tb[ntests], at pt_raw_rank_t.off
+ */
+typedef struct {
+    char magic[8];          // PT_RAW_MAGIC
+    int64_t ntests, nrank;
+    int64_t ta, tb;         // Target gauge times, ns
+    char timer[128], gauge[128];
+    double gpns;            // Gauges per ns of rank 0
+} pt_raw_header_t;
+
+typedef struct {
+    int64_t off;            // Byte offset of the ta samples of the rank
+    double gpns;            // Gauges per ns measured by the rank
+} pt_raw_rank_t;
+
+int pt_report_w(pt_opts_t *ptopts, int64_t **p_cdf);
+int pt_write_raw_csv(int id, int64_t **p_tmet, int64_t ntests);
+
+#ifdef PTOPT_USE_MPI
+int pt_write_raw_mpiio(const char *fpath, const pt_raw_header_t *hdr, double gpns,
+                       int64_t **p_tmet, MPI_Comm comm);
+#endif
+
+#endif
@@ -0,0 +1,236 @@
+/**
+ * @file ptsync.c
+ * @brief: Per-iteration synchronization of partes ranks.
+ */
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "pterr.h"
+#include "ptsync.h"
+
+void
+pt_spin_bar_init(pt_spin_bar_t *bar, int64_t n)
+{
+    __atomic_store_n(&bar->count, n, __ATOMIC_RELAXED);
+    __atomic_store_n(&bar->sense, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief The last of n arrivals resets the counter and flips the shared sense,
+ *        the others spin until the sense matches their own flipped one.
+ * @param sense Local sense of the caller, 0 before the first wait.
+ */
+void
+pt_spin_bar_wait(pt_spin_bar_t *bar, int64_t n, int64_t *sense)
+{
+    int64_t s = !*sense;
+
+    *sense = s;
+    if (__atomic_sub_fetch(&bar->count, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_store_n(&bar->count, n, __ATOMIC_RELAXED);
+        __atomic_store_n(&bar->sense, s, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&bar->sense, __ATOMIC_ACQUIRE) != s) {
+            __PTM_PAUSE;
+        }
+    }
+}
+
+#ifdef PTOPT_USE_MPI
+
+int64_t
+pt_sync_now(void)
+{
+    struct timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (int64_t)tv.tv_sec * 1000000000LL + (int64_t)tv.tv_nsec;
+}
+
+/**
+ * @brief Estimate the offset of the clock of rank 0 to the local one. Only the
+ *        node leaders ping-pong with rank 0, each keeping the round trip with
+ *        the shortest time, whose error is at most half of it. The ranks of a
+ *        node read the same CLOCK_MONOTONIC, so they take the offset of their
+ *        leader by a broadcast, and startup costs O(nnode) round trips.
+ */
+static void
+sync_clock_offset(pt_sync_t *sync)
+{
+    int lrank;
+    int64_t t0, t1, tm, rtt_min = INT64_MAX;
+
+    sync->offset = 0;
+    if (sync->node_rank == 0) {
+        MPI_Comm_rank(sync->leader_comm, &lrank);
+        for (int r = 1; r < sync->nnode; r++) {
+            for (int k = 0; k < PT_SYNC_NPING; k++) {
+                if (lrank == 0) {
+                    MPI_Recv(&tm, 1, MPI_INT64_T, r, 0, sync->leader_comm, MPI_STATUS_IGNORE);
+                    tm = pt_sync_now();
+                    MPI_Send(&tm, 1, MPI_INT64_T, r, 0, sync->leader_comm);
+                } else if (lrank == r) {
+                    t0 = pt_sync_now();
+                    MPI_Send(&t0, 1, MPI_INT64_T, 0, 0, sync->leader_comm);
+                    MPI_Recv(&tm, 1, MPI_INT64_T, 0, 0, sync->leader_comm, MPI_STATUS_IGNORE);
+                    t1 = pt_sync_now();
+                    if (t1 - t0 < rtt_min) {
+                        rtt_min = t1 - t0;
+                        sync->offset = tm - (t0 + (t1 - t0) / 2);
+                    }
+                }
+            }
+        }
+    }
+    MPI_Bcast(&sync->offset, 1, MPI_INT64_T, 0, sync->node_comm);
+}
+
+/**
+ * @brief Set up the barrier of mode. SYNC_SHM and SYNC_TIME split the ranks
+ *        by node, then SYNC_SHM has node rank 0 allocate the spin barrier in an
+ *        MPI-3 shared window of its node, and SYNC_TIME estimates clock offsets.
+ * @param mode enum sync_name
+ * @param sync Released by pt_sync_free.
+ * @return PTERR_SUCCESS or PTERR_MPI_FAILED.
+ */
+int
+pt_sync_init(int mode, int64_t period, pt_sync_t *sync)
+{
+    int myrank, is_leader;
+    MPI_Aint size;
+    int disp_unit;
+
+    sync->mode = mode;
+    sync->node_comm = MPI_COMM_NULL;
+    sync->leader_comm = MPI_COMM_NULL;
+    sync->win = MPI_WIN_NULL;
+    sync->bar = NULL;
+    sync->node_rank = 0;
+    sync->node_size = 1;
+    sync->nnode = 1;
+    sync->sense = 0;
+    sync->offset = 0;
+    sync->t_start = 0;
+    sync->period = period;
+    sync->nmiss = 0;
+    if (mode == SYNC_MPI) {
+        return PTERR_SUCCESS;
+    }
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    if (MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, myrank, MPI_INFO_NULL,
+                            &sync->node_comm) != MPI_SUCCESS) {
+        return PTERR_MPI_FAILED;
+    }
+    MPI_Comm_rank(sync->node_comm, &sync->node_rank);
+    MPI_Comm_size(sync->node_comm, &sync->node_size);
+    is_leader = sync->node_rank == 0;
+    if (MPI_Comm_split(MPI_COMM_WORLD, is_leader ? 0 : MPI_UNDEFINED, myrank,
+                       &sync->leader_comm) != MPI_SUCCESS) {
+        return PTERR_MPI_FAILED;
+    }
+    if (is_leader) {
+        MPI_Comm_size(sync->leader_comm, &sync->nnode);
+    }
+    MPI_Bcast(&sync->nnode, 1, MPI_INT, 0, sync->node_comm);
+    if (mode == SYNC_TIME) {
+        sync_clock_offset(sync);
+        return PTERR_SUCCESS;
+    }
+
+    if (MPI_Win_allocate_shared(is_leader ? sizeof(pt_spin_bar_t) : 0, 1, MPI_INFO_NULL,
+                                sync->node_comm, &sync->bar, &sync->win) != MPI_SUCCESS) {
+        return PTERR_MPI_FAILED;
+    }
+    MPI_Win_shared_query(sync->win, 0, &size, &disp_unit, &sync->bar);
+    // The spin barrier is accessed directly, the epoch only keeps the memory
+    // model unified for the lifetime of the window.
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, sync->win);
+    if (is_leader) {
+        pt_spin_bar_init(sync->bar, sync->node_size);
+    }
+    MPI_Win_sync(sync->win);
+    MPI_Barrier(sync->node_comm);
+    MPI_Win_sync(sync->win);
+
+    return PTERR_SUCCESS;
+}
+
+/**
+ * @brief Wait for every rank. For SYNC_SHM, the ranks of a node meet in the
+ *        spin barrier, and with more than one node the leaders meet in an
+ *        MPI_Barrier before releasing their nodes through a second spin.
+ */
+void
+pt_sync_barrier(pt_sync_t *sync)
+{
+    if (sync->mode == SYNC_MPI) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        return;
+    }
+    pt_spin_bar_wait(sync->bar, sync->node_size, &sync->sense);
+    if (sync->nnode > 1) {
+        if (sync->node_rank == 0) {
+            MPI_Barrier(sync->leader_comm);
+        }
+        pt_spin_bar_wait(sync->bar, sync->node_size, &sync->sense);
+    }
+}
+
+/**
+ * @brief Broadcast the start time of slot 0 from rank 0, PT_SYNC_LEAD ns ahead,
+ *        and convert it to the local clock.
+ */
+void
+pt_sync_start(pt_sync_t *sync)
+{
+    int myrank;
+    int64_t t_start = 0;
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    if (myrank == 0) {
+        t_start = pt_sync_now() + PT_SYNC_LEAD;
+    }
+    MPI_Bcast(&t_start, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+    sync->t_start = t_start - sync->offset;
+    sync->nmiss = 0;
+}
+
+/**
+ * @brief Spin until slot islot starts. A rank arriving after the start counts
+ *        a miss and goes on at once, so one late slot does not shift the others.
+ */
+void
+pt_sync_wait_slot(pt_sync_t *sync, int64_t islot)
+{
+    int64_t t = sync->t_start + islot * sync->period;
+
+    if (pt_sync_now() > t) {
+        sync->nmiss++;
+        return;
+    }
+    while (pt_sync_now() < t) {
+        __PTM_PAUSE;
+    }
+}
+
+void
+pt_sync_free(pt_sync_t *sync)
+{
+    if (sync->win != MPI_WIN_NULL) {
+        MPI_Win_unlock_all(sync->win);
+        MPI_Win_free(&sync->win);
+    }
+    if (sync->leader_comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&sync->leader_comm);
+    }
+    if (sync->node_comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&sync->node_comm);
+    }
+    sync->bar = NULL;
+}
+
+#endif
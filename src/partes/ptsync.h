@@ -0,0 +1,101 @@
+/**
+ * @file ptsync.h
+ * @brief: Per-iteration synchronization of partes ranks.
+ */
+#ifndef PTSYNC_H
+#define PTSYNC_H
+
+#include <stdint.h>
+
+#ifdef PTOPT_USE_MPI
+#include <mpi.h>
+#endif
+
+#define PT_CACHE_LINE 64
+#define PT_SYNC_NPING 16        // Round trips per rank when estimating clock offsets
+#define PT_SYNC_LEAD 1000000    // ns between broadcasting t_start and the first slot
+#define PT_SYNC_NWARM 8         // Untimed iterations of ta and tb that set the default period
+#define PT_SYNC_MARGIN 20000    // ns added to the default period
+#define PT_SYNC_MAX_MISS 0.01   // Largest share of late slot starts of a valid run
+
+#ifndef __PTM_NOP
+#define __PTM_NOP __asm__ __volatile__ ("nop");
+#endif
+
+/* Memory fence for different ISAs */
+#if defined(__x86_64__) || defined(__i386__)
+#define __PTM_MFENCE __asm__ __volatile__ ("mfence" ::: "memory");
+#elif defined(__aarch64__) || defined(__arm__)
+#define __PTM_MFENCE __asm__ __volatile__ ("dmb sy" ::: "memory");
+#elif defined(__powerpc__) || defined(__ppc__) || defined(__PPC__)
+#define __PTM_MFENCE __asm__ __volatile__ ("sync" ::: "memory");
+#elif defined(__riscv)
+#define __PTM_MFENCE __asm__ __volatile__ ("fence rw,rw" ::: "memory");
+#elif defined(__s390x__)
+#define __PTM_MFENCE __asm__ __volatile__ ("bcr 15,0" ::: "memory");
+#elif defined(__sparc__)
+#define __PTM_MFENCE __asm__ __volatile__ ("membar #Sync" ::: "memory");
+#elif defined(__alpha__)
+#define __PTM_MFENCE __asm__ __volatile__ ("mb" ::: "memory");
+#elif defined(__ia64__)
+#define __PTM_MFENCE __asm__ __volatile__ ("mf" ::: "memory");
+#else
+/* Fallback to compiler barrier */
+#define __PTM_MFENCE __asm__ __volatile__ ("" ::: "memory");
+#endif
+
+/* Spin-wait hint for different ISAs */
+#if defined(__x86_64__) || defined(__i386__)
+#define __PTM_PAUSE __asm__ __volatile__ ("pause" ::: "memory");
+#elif defined(__aarch64__)
+#define __PTM_PAUSE __asm__ __volatile__ ("yield" ::: "memory");
+#else
+#define __PTM_PAUSE __asm__ __volatile__ ("" ::: "memory");
+#endif
+
+enum sync_name {
+    SYNC_MPI = 0,   // MPI_Barrier on MPI_COMM_WORLD
+    SYNC_SHM,       // Spin barrier in shared memory, MPI_Barrier among node leaders
+    SYNC_TIME       // No barrier, iteration i starts at t_start + i * period
+};
+
+/**
+ * Sense-reversing barrier. The counter and the sense flag sit on their own
+ * cache lines, so waiters spinning on the flag do not hit the line being
+ * decremented by late arrivals.
+ */
+typedef struct {
+    volatile int64_t count;
+    char pad0[PT_CACHE_LINE - sizeof(int64_t)];
+    volatile int64_t sense;
+    char pad1[PT_CACHE_LINE - sizeof(int64_t)];
+} pt_spin_bar_t;
+
+void pt_spin_bar_init(pt_spin_bar_t *bar, int64_t n);
+void pt_spin_bar_wait(pt_spin_bar_t *bar, int64_t n, int64_t *sense);
+
+#ifdef PTOPT_USE_MPI
+
+typedef struct {
+    int mode;               // enum sync_name
+    MPI_Comm node_comm;     // Ranks sharing memory with this one
+    MPI_Comm leader_comm;   // Rank 0 of each node_comm, MPI_COMM_NULL on the others
+    MPI_Win win;
+    pt_spin_bar_t *bar;     // In the shared window of node_comm
+    int node_rank, node_size, nnode;
+    int64_t sense;          // Local sense of pt_spin_bar_wait
+    int64_t offset;         // Clock of rank 0 minus the local clock, in ns
+    int64_t t_start, period;    // Local CLOCK_MONOTONIC time of slot 0, and the slot length
+    int64_t nmiss;          // Slots whose start had passed when the rank got to them
+} pt_sync_t;
+
+int64_t pt_sync_now(void);
+int pt_sync_init(int mode, int64_t period, pt_sync_t *sync);
+void pt_sync_barrier(pt_sync_t *sync);
+void pt_sync_start(pt_sync_t *sync);
+void pt_sync_wait_slot(pt_sync_t *sync, int64_t islot);
+void pt_sync_free(pt_sync_t *sync);
+
+#endif
+
+#endif
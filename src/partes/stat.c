@@ -50,7 +50,108 @@ calc_cdf_u64(uint64_t *raw, size_t len, uint64_t *cdf, uint64_t ntiles)
     }
 }
 
+#ifdef PTOPT_USE_MPI
+/* Number of elements of the sorted arr not greater than v. */
+static size_t
+_upper_bound_i64(const int64_t *arr, size_t len, int64_t v)
+{
+    size_t lo = 0, hi = len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (arr[mid] <= v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief Same tiles as calc_cdf_i64 on the raw arrays of all ranks in comm put
+ *        together, without gathering them. Each tile is bisected on its value:
+ *        every step counts the local samples not above the midpoint of every
+ *        tile, and one MPI_Allreduce sums the counts. A rank holds a sorted copy
+ *        of its own samples and O(ntiles) counters, and at most 64 steps are run.
+ * @param raw Local samples, not modified.
+ * @param cdf Filled on every rank.
+ */
+int
+calc_cdf_i64_mpi(int64_t *raw, size_t len, int64_t *cdf, uint64_t ntiles, MPI_Comm comm)
+{
+    int err = PTERR_SUCCESS;
+    int64_t *sorted = NULL, *lo = NULL, *hi = NULL, *cnt = NULL;
+    int64_t nloc = (int64_t)len, nall = 0, vmin = INT64_MAX, vmax = INT64_MIN;
+
+    sorted = (int64_t *)malloc((len ? len : 1) * sizeof(int64_t));
+    lo = (int64_t *)malloc(ntiles * sizeof(int64_t));
+    hi = (int64_t *)malloc(ntiles * sizeof(int64_t));
+    cnt = (int64_t *)malloc(ntiles * sizeof(int64_t));
+    if (sorted == NULL || lo == NULL || hi == NULL || cnt == NULL) {
+        err = PTERR_MALLOC_FAILED;
+        _ptm_exit_on_error(err, "calc_cdf_i64_mpi");
+    }
+    for (size_t i = 0; i < len; i++) {
+        sorted[i] = raw[i];
+    }
+    qsort(sorted, len, sizeof(int64_t), _comp_i64);
+    if (len) {
+        vmin = sorted[0];
+        vmax = sorted[len - 1];
+    }
+    MPI_Allreduce(&nloc, &nall, 1, MPI_INT64_T, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &vmin, 1, MPI_INT64_T, MPI_MIN, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &vmax, 1, MPI_INT64_T, MPI_MAX, comm);
+    if (nall == 0) {
+        err = PTERR_INVALID_ARGUMENT;
+        _ptm_exit_on_error(err, "calc_cdf_i64_mpi");
+    }
+    for (uint64_t i = 0; i < ntiles; i++) {
+        lo[i] = vmin;
+        hi[i] = vmax;
+    }
 
+    // The tile of rank idx is the least v with at least idx + 1 samples <= v.
+    // lo and hi are the same on every rank, so all ranks leave the loop together.
+    for (;;) {
+        int active = 0;
+        for (uint64_t i = 0; i < ntiles; i++) {
+            cnt[i] = 0;
+            if (lo[i] < hi[i]) {
+                int64_t mid = lo[i] + (int64_t)(((uint64_t)hi[i] - (uint64_t)lo[i]) / 2);
+                cnt[i] = (int64_t)_upper_bound_i64(sorted, len, mid);
+                active = 1;
+            }
+        }
+        if (!active) {
+            break;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, cnt, (int)ntiles, MPI_INT64_T, MPI_SUM, comm);
+        for (uint64_t i = 0; i < ntiles; i++) {
+            if (lo[i] < hi[i]) {
+                int64_t mid = lo[i] + (int64_t)(((uint64_t)hi[i] - (uint64_t)lo[i]) / 2);
+                uint64_t idx = (uint64_t)((double)i / (double)(ntiles - 1) * (double)(nall - 1));
+                if (idx >= (uint64_t)nall) idx = nall - 1;
+                if (cnt[i] >= (int64_t)idx + 1) {
+                    hi[i] = mid;
+                } else {
+                    lo[i] = mid + 1;
+                }
+            }
+        }
+    }
+    for (uint64_t i = 0; i < ntiles; i++) {
+        cdf[i] = lo[i];
+    }
+
+EXIT:
+    free(sorted);
+    free(lo);
+    free(hi);
+    free(cnt);
+    return err;
+}
+#endif
 
 /**
  * @brief Calculate Wasserstein distance between measured and theoretical timing distributions
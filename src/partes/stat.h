@@ -4,9 +4,15 @@
  */
 #include <stdint.h>
 #include <stdlib.h>
+#ifdef PTOPT_USE_MPI
+#include <mpi.h>
+#endif
 
 void calc_cdf_i64(int64_t *raw, size_t len, int64_t *cdf, uint64_t ntiles);
 void calc_cdf_u64(uint64_t *raw, size_t len, uint64_t *cdf, uint64_t ntiles);
+#ifdef PTOPT_USE_MPI
+int calc_cdf_i64_mpi(int64_t *raw, size_t len, int64_t *cdf, uint64_t ntiles, MPI_Comm comm);
+#endif
 int calc_w(int64_t *cdf_a, int64_t *cdf_b, int ntiles, double p_zcut, double *w);
 
 // Variance calculation functions - all return double variance
@@ -35,14 +35,14 @@ do
         mkdir $res_dir
         mpirun --map-by core --bind-to core -np ${np} ./${kernel}_${m}.x $iarr $tsc
         mv ./*.csv $met_dir
-        nsamp=`python3 ../filt/get_quantile.py ${met_dir} 1 0.5 ${nspv}`
+        ../filt/filt-agg.x -m ${met_dir} -c 1 -v ${nspv} -t ${np} -o ${res_dir}
+        nsamp=`cat ${res_dir}/nsamp.out`
+        binw=`cat ${res_dir}/binw.out`
         mpirun --map-by core --bind-to core -np ${np} ./${kernel}_${m}_tf.x $iarr $nsamp $tsc
         mv ./*.csv $tf_dir
-        python3 ../filt/get_met.py $met_dir 1
-        python3 ../filt/get_tf.py $tf_dir 1 2 $nspv
-        binw=`python3 ../filt/get_binw.py ${met_dir} 1`
-        ./filt.x -w $binw -n 100000 -l 0.01
-        mv met.csv tf.csv tr_hist.csv sim_cdf.csv $res_dir
+        ../filt/filt-agg.x -s ${tf_dir} -S 1 -T 2 -v ${nspv} -t ${np} -o ${res_dir}
+        ./filt.x -m ${res_dir}/met.csv -s ${res_dir}/tf.csv -w $binw -n 100000 -l 0.01
+        mv tr_hist.csv sim_cdf.csv $res_dir
     done
 done
 